@@ -0,0 +1,93 @@
+/* include area */
+#include "arena.hpp"
+#include "log.hpp"
+
+using std::endl;
+using std::string;
+
+
+/** Rounds \a value up to a multiple of \a align (a power of 2). */
+static size_t _align_up( size_t value, size_t align ) {
+    return ( value + align - 1 ) & ~( align - 1 );
+}
+
+
+/**
+ * Creates a new arena.
+ *
+ * \param key   Key of the IPC resource.
+ * \param bytes Size of the arena.
+ */
+void IPC::Arena::Create( IPC::Key key, size_t bytes ) {
+    if( bytes < sizeof( Header ) )
+        throw IPC::Arena::Error( "arena too small" );
+
+    IPC::SharedMem<char>::Create( key, bytes );
+    IPC::SharedMem<char> mem{ key, bytes };
+
+    Header* header = new( mem.get_ptr( 0 ) ) Header;
+    header->top.store( _align_up( sizeof( Header ), alignof( std::max_align_t ) ) );
+    header->capacity = bytes;
+    header->root.store( 0 );
+
+    LOG_DBG << "arena of " << bytes << " bytes - key=" << key << endl;
+}
+
+/**
+ * Destroys an arena (all the objects in it are lost).
+ */
+void IPC::Arena::Destroy( IPC::Key key ) {
+    IPC::SharedMem<char>::Destroy( key );
+}
+
+
+/**
+ * Constructor implementation.
+ */
+IPC::Arena::Arena( IPC::Key key ) : mem(key) {
+    this->header = reinterpret_cast<Header*>( this->mem.get_ptr( 0 ) );
+}
+
+/**
+ * Destructor implementation.
+ */
+IPC::Arena::~Arena() {
+}
+
+
+/**
+ * Takes memory from the arena. Any process can allocate at the same time.
+ *
+ * \param bytes Size of the memory.
+ * \param align Alignment of the memory (a power of 2).
+ * \return Pointer to the memory (valid only in this process, see \c OffsetPtr).
+ */
+void* IPC::Arena::allocate( size_t bytes, size_t align ) {
+    size_t top = this->header->top.load( std::memory_order_relaxed );
+    size_t begin;
+    do {
+        begin = _align_up( top, align );
+        if( begin + bytes > this->header->capacity ) {
+            throw IPC::Arena::Error( "arena exhausted: " + std::to_string( bytes ) + " bytes requested, " +
+                                     std::to_string( this->header->capacity - top ) + " available" );
+        }
+    } while( !this->header->top.compare_exchange_weak( top, begin + bytes, std::memory_order_relaxed ) );
+
+    return &this->mem[begin];
+}
+
+/**
+ * Registers the root object (it must be in the arena).
+ */
+void IPC::Arena::set_root( void* ptr ) {
+    size_t offset = static_cast<char*>( ptr ) - &this->mem[0];
+    this->header->root.store( offset, std::memory_order_release );
+}
+
+size_t IPC::Arena::used() const {
+    return this->header->top.load( std::memory_order_relaxed );
+}
+
+size_t IPC::Arena::capacity() const {
+    return this->header->capacity;
+}
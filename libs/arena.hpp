@@ -0,0 +1,248 @@
+#ifndef ARENA_HPP
+#define ARENA_HPP
+
+
+/* include area */
+#include "ipc.hpp"
+#include "shared_mem.hpp"
+#include <atomic>
+#include <cstddef>
+#include <new>
+#include <stdint.h>
+#include <string>
+#include <type_traits>
+#include <utility>
+
+using std::size_t;
+
+
+namespace IPC {
+
+    /**
+     * A pointer that stays valid in every process that maps the segment, whatever the address of
+     * the mapping. It keeps the distance from itself to the object, so both must be in the same
+     * segment (the pointer can only be used inside shared memory, not in the stack).
+     */
+    template<class T> class OffsetPtr {
+    public:
+        OffsetPtr() {}
+        OffsetPtr( T* ptr ) { this->set( ptr ); }
+        OffsetPtr( const OffsetPtr& other ) { this->set( other.get() ); }
+
+        OffsetPtr& operator=( const OffsetPtr& other ) { this->set( other.get() ); return *this; }
+        OffsetPtr& operator=( T* ptr ) { this->set( ptr ); return *this; }
+
+        T* get() const {
+            if( this->offset == NULL_OFFSET ) {
+                return nullptr;
+            }
+            return reinterpret_cast<T*>( reinterpret_cast<intptr_t>( this ) + this->offset );
+        }
+
+        T* operator->() const { return this->get(); }
+        T& operator*() const { return *this->get(); }
+        T& operator[]( size_t index ) const { return this->get()[index]; }
+        explicit operator bool() const { return this->offset != NULL_OFFSET; }
+
+    private:
+        /** An object can't be 1 byte after its pointer, so the value is used as null. */
+        static const intptr_t NULL_OFFSET = 1;
+
+        void set( T* ptr ) {
+            this->offset = ( ptr == nullptr ? NULL_OFFSET : reinterpret_cast<intptr_t>( ptr ) - reinterpret_cast<intptr_t>( this ) );
+        }
+
+        intptr_t offset{ NULL_OFFSET };
+    };
+
+
+    /**
+     * A region of shared memory where objects are allocated by bumping a shared offset (with no
+     * syscalls nor locks). Memory is never released: the objects that are created and destroyed
+     * often should live in a \c Pool taken from the arena.
+     * The objects allocated must use \c OffsetPtr to point to each other. The root object is
+     * registered so the other processes can find the structures.
+     */
+    class Arena {
+
+    public:
+        /**
+         * Class used for Arena exceptions.
+         */
+        class Error : public IPC::Error {
+            public:
+                Error( const std::string& message ) : IPC::Error( message ) {}
+                ~Error() {}
+        };
+
+        /** Static methods used to create and destroy the IPC resources */
+        static void Create( IPC::Key key, size_t bytes );
+        static void Destroy( IPC::Key key );
+
+        /** Maps an arena created by another process. */
+        Arena( IPC::Key key );
+        Arena( const Arena& other ) = delete;
+        Arena& operator=( const Arena& other ) = delete;
+        ~Arena();
+
+        /** Allocates memory (throws if the arena is exhausted). */
+        void* allocate( size_t bytes, size_t align = alignof( std::max_align_t ) );
+
+        /** Allocates and constructs an object. */
+        template<class T, class... Args> T* create( Args&&... args );
+
+        /** Sets/gets the object used to find the rest of the structures (\c nullptr if not set). */
+        void set_root( void* ptr );
+        template<class T> T* root();
+
+        /** Bytes allocated and total size of the arena. */
+        size_t used() const;
+        size_t capacity() const;
+
+    private:
+        struct Header {
+            std::atomic<size_t> top;
+            size_t capacity;
+            std::atomic<size_t> root;
+        };
+
+        IPC::SharedMem<char> mem;
+        Header* header{ nullptr };
+    };
+
+
+    /**
+     * A pool of objects of type T taken from an arena, with a lock-free free list, so objects can be
+     * allocated and released by any process. The pool itself must be in the arena (it's created
+     * with \c Arena::create).
+     */
+    template<class T> class Pool {
+    public:
+        Pool( Arena& arena, uint32_t capacity );
+        Pool( const Pool& other ) = delete;
+        Pool& operator=( const Pool& other ) = delete;
+
+        /** Takes memory for an object (\c nullptr if there's none left). */
+        T* allocate();
+        /** Gives back memory taken with \c allocate. */
+        void release( T* elem );
+
+        /** Same as \c allocate / \c release but constructing/destroying the object. */
+        template<class... Args> T* create( Args&&... args );
+        void destroy( T* elem );
+
+        uint32_t capacity() const { return this->n; }
+        uint32_t available() const { return this->free_count.load( std::memory_order_relaxed ); }
+
+    private:
+        struct Slot {
+            std::atomic<uint32_t> next;
+            typename std::aligned_storage<sizeof( T ), alignof( T )>::type storage;
+        };
+
+        static const uint32_t NIL = UINT32_MAX;
+
+        void push( uint32_t index );
+        uint32_t pop();
+
+        /** Index of the first free slot in the lower half and a counter in the upper half,
+         *  changed on every update so a stale compare-and-swap fails (ABA). */
+        std::atomic<uint64_t> head;
+        std::atomic<uint32_t> free_count;
+        uint32_t n;
+        OffsetPtr<Slot> slots;
+    };
+}
+
+
+/**
+ * Implementation
+ */
+
+
+template <class T> const intptr_t IPC::OffsetPtr<T>::NULL_OFFSET;
+template <class T> const uint32_t IPC::Pool<T>::NIL;
+
+
+template <class T, class... Args> T* IPC::Arena::create( Args&&... args ) {
+    void* ptr = this->allocate( sizeof( T ), alignof( T ) );
+    return new( ptr ) T( std::forward<Args>( args )... );
+}
+
+template <class T> T* IPC::Arena::root() {
+    size_t offset = this->header->root.load( std::memory_order_acquire );
+    return ( offset == 0 ? nullptr : reinterpret_cast<T*>( &this->mem[offset] ) );
+}
+
+
+/**
+ * Creates a pool with space for \a capacity objects (all free).
+ */
+template <class T> IPC::Pool<T>::Pool( IPC::Arena& arena, uint32_t capacity ) : n(capacity) {
+    Slot* slots = static_cast<Slot*>( arena.allocate( sizeof( Slot ) * capacity, alignof( Slot ) ) );
+    this->slots = slots;
+
+    /* links all the slots in order */
+    for( uint32_t i = 0; i < capacity; i++ ) {
+        slots[i].next.store( i + 1 < capacity ? i + 1 : NIL, std::memory_order_relaxed );
+    }
+    this->head.store( capacity > 0 ? 0 : NIL, std::memory_order_relaxed );
+    this->free_count.store( capacity, std::memory_order_release );
+}
+
+template <class T> T* IPC::Pool<T>::allocate() {
+    uint32_t index = this->pop();
+    if( index == NIL ) {
+        return nullptr;
+    }
+    return reinterpret_cast<T*>( &this->slots[index].storage );
+}
+
+template <class T> void IPC::Pool<T>::release( T* elem ) {
+    Slot* first = this->slots.get();
+    uint32_t index = ( reinterpret_cast<char*>( elem ) - reinterpret_cast<char*>( &first->storage ) ) / sizeof( Slot );
+    this->push( index );
+}
+
+template <class T> template <class... Args> T* IPC::Pool<T>::create( Args&&... args ) {
+    T* ptr = this->allocate();
+    return ( ptr == nullptr ? nullptr : new( ptr ) T( std::forward<Args>( args )... ) );
+}
+
+template <class T> void IPC::Pool<T>::destroy( T* elem ) {
+    elem->~T();
+    this->release( elem );
+}
+
+
+template <class T> void IPC::Pool<T>::push( uint32_t index ) {
+    uint64_t old = this->head.load( std::memory_order_relaxed );
+    uint64_t desired;
+    do {
+        this->slots[index].next.store( static_cast<uint32_t>( old ), std::memory_order_relaxed );
+        desired = ( ( ( old >> 32 ) + 1 ) << 32 ) | index;
+    } while( !this->head.compare_exchange_weak( old, desired, std::memory_order_release, std::memory_order_relaxed ) );
+
+    this->free_count.fetch_add( 1, std::memory_order_relaxed );
+}
+
+template <class T> uint32_t IPC::Pool<T>::pop() {
+    uint64_t old = this->head.load( std::memory_order_acquire );
+    uint64_t desired;
+    do {
+        uint32_t index = static_cast<uint32_t>( old );
+        if( index == NIL ) {
+            return NIL;
+        }
+
+        /* if another process took the slot meanwhile, the counter changed and the CAS fails */
+        uint32_t next = this->slots[index].next.load( std::memory_order_relaxed );
+        desired = ( ( ( old >> 32 ) + 1 ) << 32 ) | next;
+    } while( !this->head.compare_exchange_weak( old, desired, std::memory_order_acquire, std::memory_order_acquire ) );
+
+    this->free_count.fetch_sub( 1, std::memory_order_relaxed );
+    return static_cast<uint32_t>( old );
+}
+
+
+#endif
@@ -1,5 +1,6 @@
 /* include area */
 #include "barrier.hpp"
+#include "futex.hpp"
 #include "log.hpp"
 #include <errno.h>
 #include <string.h>
@@ -8,51 +9,92 @@
 
 using std::endl;
 using std::string;
+using IPC::MappedMem;
 
 
 /**
- * Creates a new Barrier resource
+ * Maps the counters of a barrier (expecting it's already created).
+ *
+ * \param name Name of the shared memory object.
+ * \param n    Number of counters (0 to map all of them).
+ */
+template <typename E> static MappedMem<std::atomic<uint32_t>> _map( const string& name, size_t n ) {
+    try {
+        return MappedMem<std::atomic<uint32_t>>{ name, n, IPC::MapOptions::none };
+    } catch( const IPC::SharedMemError& e ) {
+        throw E( static_cast<string>( "barrier open: " ) + e.what() );
+    }
+}
+
+
+/**
+ * Blocks while the counter is not 0.
+ */
+template <typename E> static void _wait( std::atomic<uint32_t>* counter ) {
+    uint32_t value;
+    while( ( value = counter->load( std::memory_order_acquire ) ) != 0 ) {
+        /* sleeps while the value is unchanged (EAGAIN means it changed before sleeping) */
+        if( IPC::futex_wait( counter, value ) < 0 && errno != EAGAIN ) {
+            throw E( static_cast<string>( "barrier wait: " ) + strerror( errno ) );
+        }
+    }
+}
+
+/**
+ * Decrements the counter, blocking while it's 0. The processes waiting on the counter are woken
+ * up when it gets to 0.
+ */
+template <typename E> static void _signal( std::atomic<uint32_t>* counter ) {
+    uint32_t value = counter->load( std::memory_order_relaxed );
+    while( true ) {
+        if( value == 0 ) {
+            if( IPC::futex_wait( counter, 0 ) < 0 && errno != EAGAIN ) {
+                throw E( static_cast<string>( "barrier signal: " ) + strerror( errno ) );
+            }
+            value = counter->load( std::memory_order_relaxed );
+            continue;
+        }
+
+        if( counter->compare_exchange_weak( value, value - 1, std::memory_order_acq_rel ) ) {
+            break;
+        }
+    }
+
+    if( value == 1 ) {
+        IPC::futex_wake( counter, INT32_MAX );
+    }
+}
+
+
+/**
+ * Creates a new Barrier resource (open: its value is 0).
  * 
- * \param filename The filename to use for the IPC resource for the barrier.
+ * \param key Key of the IPC resource for the barrier.
  */
 void IPC::Barrier::Create( IPC::Key key ) {
-    /* creates the semaphore */
-    int semid = semget( key.value, 1, 0644 | IPC_CREAT | IPC_EXCL );
-    if( semid < 0 )
-        throw IPC::Barrier::Error( static_cast<string>( "semget: " ) + strerror( errno ) );
-
-    LOG_DBG << "semid: " << semid << endl;
+    try {
+        MappedMem<std::atomic<uint32_t>>::Create( key, 1 );
+    } catch( const IPC::SharedMemError& e ) {
+        throw IPC::Barrier::Error( static_cast<string>( "barrier create: " ) + e.what() );
+    }
 }
 
 void IPC::Barrier::Create( IPC::Key key, size_t n ) {
     Barrier::Create( key );
 
-    /* opens the semaphore (expecting it's already created) */
-    int semid = semget( key.value, 1, 0644 );
-    if( semid < 0 )
-        throw IPC::Barrier::Error( static_cast<string>( "semget: " ) + strerror( errno ) );
-
-    /* initializes the semaphore */
-    if( semctl( semid, 0, SETVAL, n ) )
-        throw IPC::Barrier::Error( static_cast<string>( "semctl: ") + strerror( errno ) );
+    /* initializes the counter */
+    Barrier barrier{ key };
+    barrier.set( n );
 }
 
 /**
  * Destroys a barrier created before, deallocating the OS resources.
  * 
- * \param filename Filename of the barrier to destroy.
- * \param proj_id  ASCII char to get the token.
+ * \param key Key of the barrier to destroy.
  */
 void IPC::Barrier::Destroy( IPC::Key key ) {
-    /* gets the semaphore */
-    int semid = semget( key.value, 1, 0644 );
-    if( semid < 0 ) {
-        LOG_DBG << strerror( errno ) << " - key=" << key << endl;
-        return;
-    }
-
-    LOG_DBG << "destroy: " << semid << " - key=" << key << endl;
-    semctl( semid, 0, IPC_RMID, NULL );
+    LOG_DBG << "destroy barrier - key=" << key << endl;
+    MappedMem<std::atomic<uint32_t>>::Destroy( key );
 }
 
 
@@ -64,41 +106,40 @@ void IPC::Barrier::Destroy( IPC::Key key ) {
 IPC::Barrier::Barrier( IPC::Key key, size_t n ) : Barrier(key) {
     this->n = n;
 
-    /* initializes the semaphore */
+    /* initializes the counter */
     this->set( n );
 }
 
 /**
- * Copy constructor
+ * Copy constructor (the counter is mapped again).
  * 
  * \param other Instance to copy from.
  */
-IPC::Barrier::Barrier( const Barrier& other ) : n{other.n}, semid{other.semid}  {
+IPC::Barrier::Barrier( const Barrier& other ) : n{other.n}, name{other.name}, mem{_map<Barrier::Error>( other.name, 1 )} {
+    this->counter = this->mem.get_ptr( 0 );
 }
 
 /**
  * Move constructor.
  */
-IPC::Barrier::Barrier( Barrier&& other ) : n{other.n}, semid{other.semid} {
-    other.semid = -1;
+IPC::Barrier::Barrier( Barrier&& other ) : n{other.n}, name{std::move( other.name )}, mem{std::move( other.mem )}, counter{other.counter} {
+    other.counter = nullptr;
     other.n = 0;
 }
 
-IPC::Barrier::Barrier( IPC::Key key ) {
-    /* opens the semaphore (expecting it's already created) */
-    this->semid = semget( key.value, 1, 0644 );
-    if( this->semid < 0 )
-        throw IPC::Barrier::Error( static_cast<string>( "semget: " ) + strerror( errno ) );
-
-    LOG_DBG << "barrier create: " << this->semid << endl;
+IPC::Barrier::Barrier( IPC::Key key ) : name{MappedMem<std::atomic<uint32_t>>::Name( key )}, mem{_map<Barrier::Error>( this->name, 1 )} {
+    this->counter = this->mem.get_ptr( 0 );
+    LOG_DBG << "barrier open: " << this->name << endl;
 }
 
 /**
- * Copy constructor.
+ * Move assignment.
  */
 IPC::Barrier& IPC::Barrier::operator=( Barrier&& other ) {
-    std::swap( this->semid, other.semid );
     std::swap( this->n, other.n );
+    std::swap( this->name, other.name );
+    std::swap( this->counter, other.counter );
+    this->mem = std::move( other.mem );
     return *this;
 }
 
@@ -111,34 +152,18 @@ IPC::Barrier::~Barrier() {
 
 /**
  * Blocks the calling process until the expected number of processes have reached the barrier.
+ * An open barrier costs a single atomic load.
  */
 void IPC::Barrier::wait() {
-    struct sembuf sops;
-    sops.sem_flg = SEM_UNDO;
-    sops.sem_num = 0;
-
-    /* waits for the value to be 0 */
-    sops.sem_op = 0;
-
-    int rv = semop( this->semid, &sops, 1 );
-    if( rv < 0 )
-        throw IPC::Barrier::Error( static_cast<string>( "barrier wait: " ) + strerror( errno ) );
+    _wait<Barrier::Error>( this->counter );
 }
 
 /**
  * Signals that a process has reached the barrier.
+ * As with a semaphore, blocks while the value is 0.
  */
 void IPC::Barrier::signal() {
-    struct sembuf sops;
-    sops.sem_flg = SEM_UNDO;
-    sops.sem_num = 0;
-
-    /* decrements the semaphore's counter */
-    sops.sem_op = -1;
-
-    int rv = semop( this->semid, &sops, 1 );
-    if( rv < 0 )
-        throw IPC::Barrier::Error( static_cast<string>( "barrier signal" ) + strerror( errno ) );
+    _signal<Barrier::Error>( this->counter );
 }
 
 /**
@@ -149,8 +174,119 @@ void IPC::Barrier::reset() {
 }
 
 void IPC::Barrier::set( size_t n ) {
-    /* sets the semaphore to the initial value */
-    if( semctl( this->semid, 0, SETVAL, n ) ) {
-        throw IPC::Barrier::Error( static_cast<string>( "semctl: ") + strerror( errno ) );
+    if( n > UINT32_MAX ) {
+        throw IPC::Barrier::Error( "barrier set: value out of range: " + std::to_string( n ) );
     }
-}
\ No newline at end of file
+
+    /* wakes the processes waiting for the value to change (to 0 or from 0) */
+    this->counter->store( static_cast<uint32_t>( n ), std::memory_order_release );
+    IPC::futex_wake( this->counter, INT32_MAX );
+}
+
+/**
+ * Gets the value of the barrier without blocking.
+ *
+ * \return Number of signals still expected.
+ */
+size_t IPC::Barrier::value() const {
+    return this->counter->load( std::memory_order_acquire );
+}
+
+
+/**
+ * BarrierSet
+ */
+
+
+/**
+ * Creates a set of barriers (all of them open).
+ *
+ * \param key Key of the IPC resource for the set.
+ * \param n   Number of barriers.
+ */
+void IPC::BarrierSet::Create( IPC::Key key, size_t n ) {
+    try {
+        MappedMem<std::atomic<uint32_t>>::Create( key, n );
+    } catch( const IPC::SharedMemError& e ) {
+        throw IPC::BarrierSet::Error( static_cast<string>( "barrier set create: " ) + e.what() );
+    }
+}
+
+void IPC::BarrierSet::Destroy( IPC::Key key ) {
+    LOG_DBG << "destroy barrier set - key=" << key << endl;
+    MappedMem<std::atomic<uint32_t>>::Destroy( key );
+}
+
+
+/**
+ * Constructor implementation: maps the whole set.
+ */
+IPC::BarrierSet::BarrierSet( IPC::Key key ) : mem{_map<BarrierSet::Error>( MappedMem<std::atomic<uint32_t>>::Name( key ), 0 )} {
+    this->n = this->mem.size();
+    this->counters = this->mem.get_ptr( 0 );
+}
+
+/**
+ * Move constructor.
+ */
+IPC::BarrierSet::BarrierSet( BarrierSet&& other ) : n{other.n}, mem{std::move( other.mem )}, counters{other.counters} {
+    other.counters = nullptr;
+    other.n = 0;
+}
+
+/**
+ * Destructor implementation.
+ */
+IPC::BarrierSet::~BarrierSet() {
+}
+
+
+/**
+ * Blocks the calling process until the barrier of the row is open.
+ */
+void IPC::BarrierSet::wait( size_t row ) {
+    _wait<BarrierSet::Error>( this->counter( row ) );
+}
+
+/**
+ * Signals that a process has reached the barrier of the row (blocks while its value is 0).
+ */
+void IPC::BarrierSet::signal( size_t row ) {
+    _signal<BarrierSet::Error>( this->counter( row ) );
+}
+
+void IPC::BarrierSet::set( size_t row, size_t value ) {
+    this->set( { { row, value } } );
+}
+
+/**
+ * Sets the counters (nothing is set if a row or a value is out of range). Only the processes
+ * blocked on the barriers that changed are woken up.
+ */
+void IPC::BarrierSet::set( const std::vector<std::pair<size_t, size_t>>& values ) {
+    for( const auto& v: values ) {
+        this->counter( v.first );
+        if( v.second > UINT32_MAX ) {
+            throw IPC::BarrierSet::Error( "barrier set: value out of range: " + std::to_string( v.second ) );
+        }
+    }
+
+    for( const auto& v: values ) {
+        std::atomic<uint32_t>* counter = this->counter( v.first );
+        if( counter->exchange( static_cast<uint32_t>( v.second ), std::memory_order_acq_rel ) != v.second ) {
+            IPC::futex_wake( counter, INT32_MAX );
+        }
+    }
+}
+
+size_t IPC::BarrierSet::value( size_t row ) const {
+    return this->counter( row )->load( std::memory_order_acquire );
+}
+
+
+std::atomic<uint32_t>* IPC::BarrierSet::counter( size_t row ) const {
+    if( row >= this->n ) {
+        throw IPC::BarrierSet::Error( "barrier set: row out of range: " + std::to_string( row ) );
+    }
+    return this->counters + row;
+}
@@ -4,9 +4,12 @@
 
 /* include area */
 #include "ipc.hpp"
+#include "mapped_mem.hpp"
+#include <atomic>
+#include <stdint.h>
 #include <string>
-#include <sys/ipc.h>
-#include <sys/sem.h>
+#include <utility>
+#include <vector>
 
 using std::size_t;
 
@@ -15,6 +18,8 @@ namespace IPC {
 
     /**
      * Creates a barrier that blocks a process until N other processes arrive at it.
+     * The counter is a 32 bit word in shared memory: checking an open barrier is a single atomic
+     * load, and the processes only go to the kernel (with a futex) when they have to block.
      */
     class Barrier {
 
@@ -50,14 +55,68 @@ namespace IPC {
         /** Sets the barrier to the original value. */
         void reset();
         void set( size_t n );
+        /** Returns the current value (0 means that the processes can go through). */
+        size_t value() const;
 
     private:
         /** Number of processes to barrier */
         size_t n{ 0 };
-        /** The internal semaphore ID */
-        int semid{ -1 };
+        /** Name of the shared memory object (used to map it again when copied) */
+        std::string name;
+        /** The mapped counter */
+        IPC::MappedMem<std::atomic<uint32_t>> mem;
+        std::atomic<uint32_t>* counter{ nullptr };
 
     };
+
+    /**
+     * A set of barriers (as \c IPC::Barrier) indexed by row, kept in a single shared memory
+     * object: creating and destroying the set does not depend on the number of barriers.
+     * Each barrier is a futex word of its own, so an update only wakes up the processes blocked
+     * on the barriers that changed.
+     */
+    class BarrierSet {
+
+    public:
+        class Error : public IPC::Error {
+            public:
+                Error( const std::string& message ) : IPC::Error( message ) {}
+                ~Error() {}
+        };
+
+        /** Creates a set of \a n barriers (all of them open) */
+        static void Create( IPC::Key key, size_t n );
+        static void Destroy( IPC::Key key );
+
+        /** Opens a set of barriers (already created by another process) */
+        BarrierSet( IPC::Key key );
+
+        BarrierSet( const BarrierSet& other ) = delete;
+        BarrierSet( BarrierSet&& other );
+        ~BarrierSet();
+
+        /** Number of barriers of the set. */
+        size_t size() const { return this->n; }
+
+        /** Waits for the barrier of a row to be open (0). */
+        void wait( size_t row );
+        /** Signals that the process reached the barrier of a row. */
+        void signal( size_t row );
+        void set( size_t row, size_t value );
+        /** Sets several barriers at once (pairs of row and value). */
+        void set( const std::vector<std::pair<size_t, size_t>>& values );
+        /** Returns the current value of a barrier (0 means that the processes can go through). */
+        size_t value( size_t row ) const;
+
+    private:
+        std::atomic<uint32_t>* counter( size_t row ) const;
+
+        /** Number of barriers */
+        size_t n{ 0 };
+        /** The mapped counters, one for each barrier */
+        IPC::MappedMem<std::atomic<uint32_t>> mem;
+        std::atomic<uint32_t>* counters{ nullptr };
+    };
 }
 
 #endif
@@ -0,0 +1,327 @@
+/* include area */
+#include "bin_log.hpp"
+#include "log.hpp"
+#include <algorithm>
+#include <errno.h>
+#include <fcntl.h>
+#include <fstream>
+#include <iterator>
+#include <pthread.h>
+#include <sstream>
+#include <time.h>
+#include <unistd.h>
+
+using std::string;
+
+
+const size_t BinLog::HEADER_SIZE;
+const size_t BinLog::EVENT_HEADER_SIZE;
+const size_t BinLog::BUFFER_SIZE;
+const size_t BinString::MAX_STRING;
+
+
+/** ID of a site, the same in all the processes (FNV-1a of its file, line and format). */
+static uint32_t _site_id( const char* file, uint32_t line, const char* format ) {
+    uint32_t hash = 2166136261u;
+    auto add = [&hash]( const char* bytes, size_t n ) {
+        for( size_t i = 0; i < n; i++ ) {
+            hash = ( hash ^ static_cast<uint8_t>( bytes[i] ) ) * 16777619u;
+        }
+    };
+    add( file, strlen( file ) + 1 );
+    add( reinterpret_cast<const char*>( &line ), sizeof( line ) );
+    add( format, strlen( format ) );
+    return hash;
+}
+
+
+/**
+ * Static method that returns the singleton's instance.
+ */
+BinLog& BinLog::get_instance() {
+    static BinLog instance;
+    return instance;
+}
+
+/**
+ * Instance constructor: the buffer is written before forking, so the children start empty.
+ * The text log is created first, so it's still there when the records lost are reported at exit.
+ */
+BinLog::BinLog() : pid(getpid()), buffer(BUFFER_SIZE) {
+    Log::get_instance();
+    pthread_atfork( [](){ BinLog::get_instance().flush(); },
+                    nullptr,
+                    [](){
+                        BinLog& log = BinLog::get_instance();
+                        log.pid = getpid();
+                        log.records_lost = 0;
+                    } );
+}
+
+BinLog::~BinLog() {
+    this->close();
+}
+
+
+void BinLog::open( const string& filename, bool truncate ) {
+    this->close();
+    this->records_lost = 0;
+    this->error.clear();
+
+    int flags = O_WRONLY | O_CREAT | O_APPEND | ( truncate ? O_TRUNC : 0 );
+    this->fd = ::open( filename.c_str(), flags, 0644 );
+    if( this->fd < 0 ) {
+        throw BinLog::Error( "open " + filename + ": " + static_cast<string>( strerror( errno ) ) );
+    }
+
+    for( const Site& site: this->sites ) {
+        this->write_site( site );
+    }
+}
+
+void BinLog::close() {
+    if( this->fd >= 0 ) {
+        this->flush();
+        ::close( this->fd );
+        this->fd = -1;
+
+        if( this->records_lost > 0 ) {
+            LOG << "binary log: " << this->records_lost << " records lost (" << this->error << ")" << std::endl;
+        }
+    }
+}
+
+/**
+ * Appends the buffer to the file in a single write, so the records of different processes are
+ * not mixed. If the write fails, the whole buffer is dropped (so the next records are not
+ * appended after a partial one).
+ */
+void BinLog::flush() {
+    if( this->fd < 0 || this->used == 0 ) {
+        return;
+    }
+
+    size_t written = 0;
+    while( written < this->used ) {
+        ssize_t n = ::write( this->fd, this->buffer.data() + written, this->used - written );
+        if( n < 0 ) {
+            if( errno == EINTR ) {
+                continue;
+            }
+            if( this->error.empty() ) {
+                this->error = "write: " + static_cast<string>( strerror( errno ) );
+            }
+            this->records_lost += this->records;
+            break;
+        }
+        written += n;
+    }
+    this->used = 0;
+    this->records = 0;
+}
+
+
+uint32_t BinLog::register_site( const char* file, uint32_t line, const char* format, const string& types ) {
+    Site site{ _site_id( file, line, format ), line, types, file, format };
+    this->sites.push_back( site );
+    if( this->is_open() ) {
+        this->write_site( site );
+    }
+    return site.id;
+}
+
+void BinLog::write_site( const Site& site ) {
+    size_t size = HEADER_SIZE + sizeof( uint32_t ) + site.types.size() + site.file.size() + 1 + site.format.size() + 1;
+    char* p = this->reserve( size );
+    if( p == nullptr ) {
+        return;
+    }
+
+    p = this->put_header( p, size, Kind::site, site.types.size(), site.id );
+    memcpy( p, &site.line, sizeof( site.line ) );
+    p += sizeof( site.line );
+    memcpy( p, site.types.data(), site.types.size() );
+    p += site.types.size();
+    memcpy( p, site.file.c_str(), site.file.size() + 1 );
+    p += site.file.size() + 1;
+    memcpy( p, site.format.c_str(), site.format.size() + 1 );
+}
+
+/**
+ * Returns where the record is written (\c nullptr if the record is too long).
+ */
+char* BinLog::reserve( size_t size ) {
+    if( size > UINT16_MAX || size > BUFFER_SIZE ) {
+        return nullptr;
+    }
+    if( this->used + size > BUFFER_SIZE ) {
+        this->flush();
+    }
+
+    char* p = &this->buffer[this->used];
+    this->used += size;
+    this->records++;
+    return p;
+}
+
+char* BinLog::put_header( char* p, size_t size, Kind kind, size_t args, uint32_t site ) {
+    uint16_t record_size = static_cast<uint16_t>( size );
+    memcpy( p, &record_size, sizeof( record_size ) );
+    p[2] = static_cast<char>( kind );
+    p[3] = static_cast<char>( args );
+    memcpy( p + 4, &site, sizeof( site ) );
+    return p + HEADER_SIZE;
+}
+
+uint64_t BinLog::now() {
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return static_cast<uint64_t>( ts.tv_sec ) * 1000000000 + ts.tv_nsec;
+}
+
+
+/**
+ * BinLogReader
+ */
+
+
+/**
+ * Reads the records of the file, checking that they are complete. The sites are read first, since
+ * a process may write its events before another one writes the sites.
+ *
+ * \param filename Name of the file.
+ */
+BinLogReader::BinLogReader( const string& filename ) {
+    std::ifstream in{ filename, std::ios::binary };
+    if( !in ) {
+        throw BinLog::Error( "could not open " + filename );
+    }
+    std::vector<char> data{ std::istreambuf_iterator<char>( in ), std::istreambuf_iterator<char>() };
+
+    for( BinLog::Kind pass: { BinLog::Kind::site, BinLog::Kind::event } ) {
+        size_t offset = 0;
+        while( offset < data.size() ) {
+            if( data.size() - offset < BinLog::HEADER_SIZE ) {
+                throw BinLog::Error( "truncated record at " + std::to_string( offset ) );
+            }
+
+            const char* p = &data[offset];
+            uint16_t size;
+            uint32_t id;
+            memcpy( &size, p, sizeof( size ) );
+            memcpy( &id, p + 4, sizeof( id ) );
+            BinLog::Kind kind = static_cast<BinLog::Kind>( p[2] );
+            size_t args = static_cast<uint8_t>( p[3] );
+
+            if( size < BinLog::HEADER_SIZE || size > data.size() - offset ) {
+                throw BinLog::Error( "bad record size at " + std::to_string( offset ) );
+            }
+            const char* end = p + size;
+            p += BinLog::HEADER_SIZE;
+            size_t record = offset;
+            offset += size;
+
+            /* the fields must be inside the record */
+            auto need = [&p, end, record]( size_t bytes ) {
+                if( static_cast<size_t>( end - p ) < bytes ) {
+                    throw BinLog::Error( "truncated record at " + std::to_string( record ) );
+                }
+            };
+
+            if( kind != pass ) {
+                continue;
+            }
+
+            if( kind == BinLog::Kind::site ) {
+                Site site;
+                need( sizeof( site.line ) + args );
+                memcpy( &site.line, p, sizeof( site.line ) );
+                p += sizeof( site.line );
+                site.types.assign( p, args );
+                p += args;
+                site.file.assign( p, strnlen( p, end - p ) );
+                need( site.file.size() + 1 );
+                p += site.file.size() + 1;
+                site.format.assign( p, strnlen( p, end - p ) );
+                this->sites[id] = site;
+                continue;
+            }
+
+            Event event;
+            int32_t pid;
+            event.site = id;
+            need( sizeof( event.timestamp ) + sizeof( pid ) );
+            memcpy( &event.timestamp, p, sizeof( event.timestamp ) );
+            memcpy( &pid, p + sizeof( event.timestamp ), sizeof( pid ) );
+            event.pid = pid;
+            p += sizeof( event.timestamp ) + sizeof( pid );
+
+            /* the types of the arguments are in the site (the arguments of unknown sites are skipped) */
+            auto it = this->sites.find( id );
+            if( it != this->sites.end() && args > it->second.types.size() ) {
+                throw BinLog::Error( "event with more arguments than its site at " + std::to_string( record ) );
+            }
+            for( size_t i = 0; it != this->sites.end() && i < args; i++ ) {
+                Value v{ it->second.types[i], 0, 0, 0, {} };
+                if( v.type == 's' ) {
+                    uint16_t length;
+                    need( sizeof( length ) );
+                    memcpy( &length, p, sizeof( length ) );
+                    p += sizeof( length );
+                    need( length );
+                    v.s.assign( p, length );
+                    p += length;
+                } else {
+                    void* value = ( v.type == 'i' ) ? static_cast<void*>( &v.i ) : ( v.type == 'u' ) ? static_cast<void*>( &v.u ) : static_cast<void*>( &v.f );
+                    need( 8 );
+                    memcpy( value, p, 8 );
+                    p += 8;
+                }
+                event.args.push_back( std::move( v ) );
+            }
+            this->events.push_back( std::move( event ) );
+        }
+    }
+
+    std::stable_sort( this->events.begin(), this->events.end(), []( const Event& a, const Event& b ) {
+        return a.timestamp < b.timestamp;
+    } );
+}
+
+const BinLogReader::Site* BinLogReader::site( const Event& event ) const {
+    auto it = this->sites.find( event.site );
+    return ( it == this->sites.end() ) ? nullptr : &it->second;
+}
+
+string BinLogReader::format( const Event& event ) const {
+    const Site* site = this->site( event );
+    if( site == nullptr ) {
+        return "<unknown site " + std::to_string( event.site ) + ">";
+    }
+
+    std::ostringstream os;
+    size_t arg = 0, pos = 0;
+    while( true ) {
+        size_t next = site->format.find( "{}", pos );
+        if( next == string::npos || arg >= event.args.size() ) {
+            os << site->format.substr( pos );
+            break;
+        }
+        os << site->format.substr( pos, next - pos ) << BinLogReader::to_string( event.args[arg++] );
+        pos = next + 2;
+    }
+    return os.str();
+}
+
+string BinLogReader::to_string( const Value& value ) {
+    switch( value.type ) {
+        case 'i': return std::to_string( value.i );
+        case 'u': return std::to_string( value.u );
+        case 'f': {
+            std::ostringstream os;
+            os << value.f;
+            return os.str();
+        }
+        default: return value.s;
+    }
+}
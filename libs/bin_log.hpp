@@ -0,0 +1,268 @@
+/**
+ * A binary log for the events that are too frequent to be logged as text.
+ */
+
+#ifndef BIN_LOG_HPP
+#define BIN_LOG_HPP
+
+
+/* include area */
+#include "ipc.hpp"
+#include <map>
+#include <stdint.h>
+#include <string>
+#include <string.h>
+#include <sys/types.h>
+#include <type_traits>
+#include <vector>
+
+
+/** File of the binary log (decoded with target/logdecode). */
+#ifndef BIN_LOG_FILE
+#  define BIN_LOG_FILE "/tmp/cv_log.bin"
+#endif
+
+/**
+ * Logs an event in the binary log (if it's open). The call site is registered the first time with
+ * the format and the types of the arguments; after that, only the ID of the site, a timestamp and
+ * the raw arguments are written. Each "{}" of the format is replaced by an argument when decoded.
+ * The arguments can be integers, enums, floating point numbers and strings.
+ *
+ * Examples:
+ *
+ *   LOG_BIN( "player {} joined", id );
+ */
+#define LOG_BIN( ... ) \
+    do { \
+        if( BinLog::get_instance().is_open() ) { \
+            static const uint32_t _log_site = BinLog::get_instance().add_site( __FILE__, __LINE__, __VA_ARGS__ ); \
+            BinLog::get_instance().write( _log_site, __VA_ARGS__ ); \
+        } \
+    } while( 0 )
+
+
+/**
+ * Encoding of each type of argument: a type character and the raw bytes.
+ */
+template <typename T, typename Enable = void> struct BinArg;
+
+template <typename T> struct BinArg<T, typename std::enable_if<std::is_integral<T>::value && std::is_signed<T>::value>::type> {
+    static const char type = 'i';
+    static size_t size( T ) { return sizeof( int64_t ); }
+    static char* put( char* p, T v ) { int64_t x = v; memcpy( p, &x, sizeof( x ) ); return p + sizeof( x ); }
+};
+
+template <typename T> struct BinArg<T, typename std::enable_if<std::is_integral<T>::value && std::is_unsigned<T>::value>::type> {
+    static const char type = 'u';
+    static size_t size( T ) { return sizeof( uint64_t ); }
+    static char* put( char* p, T v ) { uint64_t x = v; memcpy( p, &x, sizeof( x ) ); return p + sizeof( x ); }
+};
+
+template <typename T> struct BinArg<T, typename std::enable_if<std::is_enum<T>::value>::type> {
+    static const char type = 'i';
+    static size_t size( T ) { return sizeof( int64_t ); }
+    static char* put( char* p, T v ) { int64_t x = static_cast<int64_t>( v ); memcpy( p, &x, sizeof( x ) ); return p + sizeof( x ); }
+};
+
+template <typename T> struct BinArg<T, typename std::enable_if<std::is_floating_point<T>::value>::type> {
+    static const char type = 'f';
+    static size_t size( T ) { return sizeof( double ); }
+    static char* put( char* p, T v ) { double x = v; memcpy( p, &x, sizeof( x ) ); return p + sizeof( x ); }
+};
+
+/** Strings are written with their length (16 bits), truncated to \c MAX_STRING bytes. */
+struct BinString {
+    static const char type = 's';
+    static const size_t MAX_STRING = 1024;
+
+    static size_t size( const char* s, size_t n ) { return sizeof( uint16_t ) + ( n < MAX_STRING ? n : MAX_STRING ); }
+    static char* put( char* p, const char* s, size_t n ) {
+        uint16_t length = static_cast<uint16_t>( n < MAX_STRING ? n : MAX_STRING );
+        memcpy( p, &length, sizeof( length ) );
+        memcpy( p + sizeof( length ), s, length );
+        return p + sizeof( length ) + length;
+    }
+};
+
+template <> struct BinArg<const char*> : BinString {
+    static size_t size( const char* s ) { return BinString::size( s, strlen( s ) ); }
+    static char* put( char* p, const char* s ) { return BinString::put( p, s, strlen( s ) ); }
+};
+
+template <> struct BinArg<char*> : BinArg<const char*> {};
+
+template <> struct BinArg<std::string> : BinString {
+    static size_t size( const std::string& s ) { return BinString::size( s.data(), s.size() ); }
+    static char* put( char* p, const std::string& s ) { return BinString::put( p, s.data(), s.size() ); }
+};
+
+
+/**
+ * Binary log singleton.
+ * Each process keeps the records in a buffer and appends it to the file when it's full, before
+ * forking and when the process ends, so the hot path is a copy into memory. The records are not
+ * in timestamp order in the file (the decoder sorts them).
+ * Logging never fails for the caller: if the buffer can't be written it's dropped, and the number
+ * of records lost is reported (once) when the log is closed.
+ *
+ * Records: [size u16][kind u8][args u8][site u32] followed by
+ *   - site:  [line u32][type of each argument][file\0][format\0]
+ *   - event: [timestamp u64][pid i32][arguments]
+ */
+class BinLog {
+public:
+    /**
+     * Class used for BinLog exceptions.
+     */
+    class Error : public IPC::Error {
+        public:
+            Error( const std::string& message ) : IPC::Error( message ) {}
+            ~Error() {}
+    };
+
+    enum class Kind : uint8_t {
+        site = 0,
+        event = 1,
+    };
+
+    /** Size of the header of the records. */
+    static const size_t HEADER_SIZE = 8;
+    /** Size of the header of the events (timestamp and PID included). */
+    static const size_t EVENT_HEADER_SIZE = HEADER_SIZE + 12;
+
+    /** Returns the singleton instance. */
+    static BinLog& get_instance();
+
+    ~BinLog();
+
+    /**
+     * Opens the log file (the sites registered so far are written to it).
+     *
+     * \param filename Name of the file.
+     * \param truncate If \c true, the previous content is dropped.
+     */
+    void open( const std::string& filename, bool truncate );
+    void close();
+    bool is_open() const { return this->fd >= 0; }
+
+    /** Writes the buffer to the file (the records are dropped if it fails). */
+    void flush();
+
+    /** Number of records dropped since the log was opened. */
+    size_t lost() const { return this->records_lost; }
+
+    /** Registers a call site. The arguments are only used for their types. */
+    template <typename... Args> uint32_t add_site( const char* file, uint32_t line, const char* format, const Args&... args );
+
+    /** Writes an event of a call site (the format is not written). */
+    template <typename... Args> void write( uint32_t site, const char* format, const Args&... args );
+
+private:
+    /** Size of the buffer of the process. */
+    static const size_t BUFFER_SIZE = 64 * 1024;
+
+    struct Site {
+        uint32_t id;
+        uint32_t line;
+        std::string types;
+        std::string file;
+        std::string format;
+    };
+
+    BinLog();
+    BinLog( BinLog& log ) = delete;
+
+    uint32_t register_site( const char* file, uint32_t line, const char* format, const std::string& types );
+    void write_site( const Site& site );
+
+    /** Makes room for a record of \a size bytes (flushing the buffer if needed). */
+    char* reserve( size_t size );
+    char* put_header( char* p, size_t size, Kind kind, size_t args, uint32_t site );
+    static uint64_t now();
+
+    int fd{ -1 };
+    pid_t pid{ 0 };
+    std::vector<Site> sites;
+    std::vector<char> buffer;
+    size_t used{ 0 };
+
+    /** Records in the buffer, and records dropped by failed writes (with the first error). */
+    size_t records{ 0 };
+    size_t records_lost{ 0 };
+    std::string error;
+};
+
+
+/**
+ * Reads a binary log file.
+ */
+class BinLogReader {
+public:
+    struct Site {
+        uint32_t line;
+        std::string types;
+        std::string file;
+        std::string format;
+    };
+
+    struct Value {
+        char type;
+        int64_t i;
+        uint64_t u;
+        double f;
+        std::string s;
+    };
+
+    struct Event {
+        uint64_t timestamp;
+        pid_t pid;
+        uint32_t site;
+        std::vector<Value> args;
+    };
+
+    /** Reads the whole file. The events are sorted by timestamp. */
+    BinLogReader( const std::string& filename );
+    ~BinLogReader() {}
+
+    /** Returns the format of the site of the event filled with the arguments. */
+    std::string format( const Event& event ) const;
+
+    /** Returns the site of an event (\c nullptr if it was not registered). */
+    const Site* site( const Event& event ) const;
+
+    static std::string to_string( const Value& value );
+
+    std::map<uint32_t, Site> sites;
+    std::vector<Event> events;
+};
+
+
+
+template <typename... Args> uint32_t BinLog::add_site( const char* file, uint32_t line, const char* format, const Args&... args ) {
+    const char types[] = { BinArg<typename std::decay<Args>::type>::type..., '\0' };
+    return this->register_site( file, line, format, types );
+}
+
+template <typename... Args> void BinLog::write( uint32_t site, const char* format, const Args&... args ) {
+    using expand = int[];
+
+    size_t size = EVENT_HEADER_SIZE;
+    (void)expand{ 0, ( size += BinArg<typename std::decay<Args>::type>::size( args ), 0 )... };
+
+    char* p = this->reserve( size );
+    if( p == nullptr ) {
+        return;
+    }
+
+    p = this->put_header( p, size, Kind::event, sizeof...( Args ), site );
+    uint64_t timestamp = BinLog::now();
+    memcpy( p, &timestamp, sizeof( timestamp ) );
+    int32_t pid = this->pid;
+    memcpy( p + sizeof( timestamp ), &pid, sizeof( pid ) );
+    p += sizeof( timestamp ) + sizeof( pid );
+
+    (void)expand{ 0, ( p = BinArg<typename std::decay<Args>::type>::put( p, args ), 0 )... };
+}
+
+
+#endif
@@ -0,0 +1,263 @@
+#ifndef FRAMED_QUEUE_HPP
+#define FRAMED_QUEUE_HPP
+
+/* include area */
+#include "ipc.hpp"
+#include "log.hpp"
+#include "queue.hpp"
+#include <algorithm>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <string>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <vector>
+
+
+namespace IPC {
+
+    /**
+     * An inter-process queue of variable size records of at most \a MAX_SIZE bytes.
+     * Each record travels prefixed with its length, so only the bytes used are copied. Records are
+     * written with a single \c writev (atomic because they fit in \c PIPE_BUF), so any number of
+     * processes can insert, but there must be a single reader.
+     * The scatter/gather versions of insert/remove take the parts of the record from/to many
+     * buffers, so no intermediate copy is needed (for example, a header and a payload).
+     */
+    template<size_t MAX_SIZE> class FramedQueue {
+        static_assert( MAX_SIZE + sizeof( uint32_t ) <= PIPE_BUF, "records must be written atomically" );
+
+    public:
+
+        /** Maximum size of a record. */
+        static const size_t MAX_RECORD = MAX_SIZE;
+
+        /** Creates/destroys a FramedQueue that will be accessible from other modules. */
+        static void Create( const std::string& filename );
+        static void Destroy( const std::string& filename );
+
+        FramedQueue( const std::string& filename, QueueMode mode );
+        FramedQueue( const std::string& filename, QueueMode mode, bool uninterrupted );
+        FramedQueue( const FramedQueue& other ) = delete;
+        FramedQueue& operator=( const FramedQueue& other ) = delete;
+        ~FramedQueue();
+
+        /** Inserts a record made of the \a iovcnt buffers. */
+        void insert( const struct iovec* parts, int iovcnt );
+        void insert( const void* data, size_t length );
+
+        /**
+         * Removes a record, storing it in the buffers in order.
+         * Returns the length of the record (throws if it does not fit in the buffers).
+         */
+        size_t remove( const struct iovec* parts, int iovcnt );
+        size_t remove( void* data, size_t capacity );
+
+        /** Returns the file descriptor (to wait for the queue along with other sources). */
+        int get_fd() const { return this->fd; }
+
+    private:
+        /** Number of buffers kept in the stack (more parts are copied to the heap). */
+        static const int LOCAL_PARTS = 8;
+
+        void read_all( struct iovec* iov, int iovcnt, size_t length, bool started );
+
+        std::string filename;
+        int fd{ -1 };
+        bool uninterrupted;
+        /** Set when a bad length was read: the start of the next record is unknown. */
+        bool broken{ false };
+    };
+
+}
+
+/**
+ * Implementation
+ */
+
+
+template <size_t MAX_SIZE> const size_t IPC::FramedQueue<MAX_SIZE>::MAX_RECORD;
+template <size_t MAX_SIZE> const int IPC::FramedQueue<MAX_SIZE>::LOCAL_PARTS;
+
+
+/**
+ * Creates the FramedQueue so it's available to the other processes.
+ */
+template <size_t MAX_SIZE> void IPC::FramedQueue<MAX_SIZE>::Create( const std::string& filename ) {
+    if( mknod( filename.c_str(), S_IFIFO | 0644, 0 ) )
+        throw IPC::QueueError( strerror( errno ) );
+}
+
+/**
+ * Destroys the FramedQueue (no other processes will be able to connect again).
+ */
+template <size_t MAX_SIZE> void IPC::FramedQueue<MAX_SIZE>::Destroy( const std::string& filename ) {
+    unlink( filename.c_str() );
+    LOG_DBG << "destroy " << filename << std::endl;
+}
+
+
+/**
+ * FramedQueue constructor implementation.
+ */
+template <size_t MAX_SIZE> IPC::FramedQueue<MAX_SIZE>::FramedQueue( const std::string& filename, IPC::QueueMode mode ) : FramedQueue(filename, mode, false) {
+}
+
+template <size_t MAX_SIZE> IPC::FramedQueue<MAX_SIZE>::FramedQueue( const std::string& filename, IPC::QueueMode mode, bool uninterrupted ) : filename(filename),
+                                                                                                                                           uninterrupted(uninterrupted) {
+    this->fd = open( this->filename.c_str(), static_cast<int>( mode ) );
+    if( this->fd == -1 )
+        throw IPC::QueueError( strerror( errno ) );
+}
+
+/**
+ * FramedQueue destructor implementation.
+ */
+template <size_t MAX_SIZE> IPC::FramedQueue<MAX_SIZE>::~FramedQueue() {
+    if( this->fd != -1 )
+        close( this->fd );
+    this->fd = -1;
+}
+
+
+/**
+ * Inserts a record, gathering its bytes from many buffers.
+ *
+ * \param parts  Buffers with the parts of the record.
+ * \param iovcnt Number of buffers.
+ */
+template <size_t MAX_SIZE> void IPC::FramedQueue<MAX_SIZE>::insert( const struct iovec* parts, int iovcnt ) {
+    uint32_t length = 0;
+    for( int i = 0; i < iovcnt; i++ ) {
+        length += parts[i].iov_len;
+    }
+    if( length > MAX_SIZE )
+        throw IPC::QueueError( "record of " + std::to_string( length ) + " bytes is too large" );
+
+    /* the length prefix and the parts are written at once */
+    if( iovcnt + 1 > IOV_MAX )
+        throw IPC::QueueError( "too many parts" );
+    struct iovec local[LOCAL_PARTS];
+    std::vector<struct iovec> heap;
+    struct iovec* iov = local;
+    if( iovcnt + 1 > LOCAL_PARTS ) {
+        heap.resize( iovcnt + 1 );
+        iov = heap.data();
+    }
+    iov[0] = { &length, sizeof( length ) };
+    for( int i = 0; i < iovcnt; i++ ) {
+        iov[i + 1] = parts[i];
+    }
+
+    while( writev( this->fd, iov, iovcnt + 1 ) == -1 ) {
+        if( errno == EINTR && this->uninterrupted ) {
+            /* retries */
+            continue;
+        }
+        throw IPC::QueueError( strerror( errno ) );
+    }
+}
+
+template <size_t MAX_SIZE> void IPC::FramedQueue<MAX_SIZE>::insert( const void* data, size_t length ) {
+    struct iovec part = { const_cast<void *>( data ), length };
+    this->insert( &part, 1 );
+}
+
+/**
+ * Removes a record, scattering its bytes in the buffers (the first bytes go to the first buffer).
+ *
+ * \param parts  Buffers where the record is stored.
+ * \param iovcnt Number of buffers.
+ * \return The length of the record.
+ */
+template <size_t MAX_SIZE> size_t IPC::FramedQueue<MAX_SIZE>::remove( const struct iovec* parts, int iovcnt ) {
+    if( this->broken )
+        throw IPC::QueueError( "the queue is out of sync" );
+
+    uint32_t length;
+    struct iovec prefix = { &length, sizeof( length ) };
+    this->read_all( &prefix, 1, sizeof( length ), false );
+
+    if( length > MAX_SIZE ) {
+        /* the body can't be skipped without knowing its length: the stream is lost */
+        this->broken = true;
+        throw IPC::QueueError( "bad record length " + std::to_string( length ) );
+    }
+
+    /* takes only the bytes of this record (the next one may be already in the FIFO) */
+    iovcnt = std::min( iovcnt, IOV_MAX );
+    struct iovec local[LOCAL_PARTS];
+    std::vector<struct iovec> heap;
+    struct iovec* iov = local;
+    if( iovcnt > LOCAL_PARTS ) {
+        heap.resize( iovcnt );
+        iov = heap.data();
+    }
+    size_t remaining = length;
+    int count = 0;
+    for( ; count < iovcnt && remaining > 0; count++ ) {
+        iov[count] = parts[count];
+        iov[count].iov_len = std::min( iov[count].iov_len, remaining );
+        remaining -= iov[count].iov_len;
+    }
+
+    if( remaining > 0 ) {
+        /* discards the record so the next one can be read */
+        char discard[MAX_SIZE];
+        struct iovec rest = { discard, length };
+        this->read_all( &rest, 1, length, true );
+        throw IPC::QueueError( "record of " + std::to_string( length ) + " bytes does not fit in the buffers" );
+    }
+
+    this->read_all( iov, count, length, true );
+    return length;
+}
+
+template <size_t MAX_SIZE> size_t IPC::FramedQueue<MAX_SIZE>::remove( void* data, size_t capacity ) {
+    struct iovec part = { data, capacity };
+    return this->remove( &part, 1 );
+}
+
+
+/**
+ * Reads exactly \a length bytes into the buffers (their total size must be \a length).
+ * The buffers are modified. Once a byte of the record was read (\a started, for the body after
+ * the prefix) the read is never abandoned.
+ */
+template <size_t MAX_SIZE> void IPC::FramedQueue<MAX_SIZE>::read_all( struct iovec* iov, int iovcnt, size_t length, bool started ) {
+    size_t bytes = 0;
+    while( bytes < length ) {
+        ssize_t bytes_read = readv( this->fd, iov, iovcnt );
+        if( bytes_read == 0 ) {
+            throw IPC::QueueEOF();
+        }
+
+        if( bytes_read < 0 ) {
+            if( errno == EINTR && ( this->uninterrupted || started || bytes > 0 ) ) {
+                /* retries (a record is never left half read) */
+                continue;
+            }
+            throw IPC::QueueError( strerror( errno ) );
+        }
+        bytes += bytes_read;
+
+        /* skips the buffers already filled */
+        size_t skip = bytes_read;
+        while( iovcnt > 0 && skip >= iov->iov_len ) {
+            skip -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if( iovcnt > 0 ) {
+            iov->iov_base = static_cast<char *>( iov->iov_base ) + skip;
+            iov->iov_len -= skip;
+        }
+    }
+}
+
+
+#endif
@@ -0,0 +1,14 @@
+/* include area */
+#include "futex.hpp"
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+
+int IPC::futex_wait( std::atomic<uint32_t>* word, uint32_t expected, const struct timespec* timeout ) {
+    return syscall( SYS_futex, reinterpret_cast<uint32_t *>( word ), FUTEX_WAIT, expected, timeout, nullptr, 0 );
+}
+
+int IPC::futex_wake( std::atomic<uint32_t>* word, int n ) {
+    return syscall( SYS_futex, reinterpret_cast<uint32_t *>( word ), FUTEX_WAKE, n, nullptr, nullptr, 0 );
+}
@@ -0,0 +1,38 @@
+/**
+ * Wrappers around the futex system call for words placed in shared memory.
+ */
+
+#ifndef FUTEX_HPP
+#define FUTEX_HPP
+
+/* include area */
+#include <atomic>
+#include <stdint.h>
+#include <time.h>
+
+
+namespace IPC {
+
+    static_assert( sizeof( std::atomic<uint32_t> ) == sizeof( uint32_t ), "futex words must be 32 bits" );
+
+    /**
+     * Blocks the calling process while \a word holds the \a expected value.
+     * The futex is not private, so it works on memory shared by different processes.
+     *
+     * \param word     Word to wait on.
+     * \param expected Value the word is expected to have.
+     * \param timeout  Relative timeout (\c nullptr waits forever).
+     * \return 0 when woken, -1 on error (\c errno is EAGAIN, EINTR or ETIMEDOUT).
+     */
+    int futex_wait( std::atomic<uint32_t>* word, uint32_t expected, const struct timespec* timeout = nullptr );
+
+    /**
+     * Wakes up to \a n processes blocked on \a word.
+     *
+     * \return Number of processes woken up.
+     */
+    int futex_wake( std::atomic<uint32_t>* word, int n );
+}
+
+
+#endif
@@ -0,0 +1,299 @@
+#ifndef JOURNAL_HPP
+#define JOURNAL_HPP
+
+/* include area */
+#include "ipc.hpp"
+#include "log.hpp"
+#include <atomic>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <string>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <type_traits>
+#include <unistd.h>
+
+
+namespace IPC {
+
+    /**
+     * An append-only log of elements of type T kept in a memory mapped file (the segment).
+     * Each record is copied into the mapping and then published by increasing the counter in the
+     * header, so the records survive if the process dies at any point. The write of the records to
+     * the disk is started every \c group records (group commit, with \c sync_file_range) so appending
+     * never waits for the disk; \c commit waits for all of them.
+     * A journal must have a single writer. The file is kept when the processes die, so the records
+     * can be replayed with a sequential scan when starting again.
+     */
+    template<class T> class Journal {
+        static_assert( std::is_trivially_copyable<T>::value, "records are copied to the file" );
+
+    public:
+        /**
+         * Class used for Journal exceptions.
+         */
+        class Error : public IPC::Error {
+            public:
+                Error( const std::string& message ) : IPC::Error( message ) {}
+                ~Error() {}
+        };
+
+        /** Default number of records between flushes. */
+        static const size_t DEFAULT_GROUP = 64;
+
+        /** Creates the segment with space for \a capacity records (existing records are kept). */
+        static void Create( const std::string& filename, size_t capacity );
+        static void Destroy( const std::string& filename );
+
+        Journal( const std::string& filename );
+        Journal( const std::string& filename, size_t group );
+        Journal( const Journal& other ) = delete;
+        Journal& operator=( const Journal& other ) = delete;
+        ~Journal();
+
+        /** Appends records. Returns \c false (appending nothing) if the segment is full. */
+        bool append( const T* elems, size_t n );
+
+        /** Flushes the records appended to the disk. */
+        void commit();
+
+        /** Calls \a f with each record, in the order they were appended. Returns the number of records. */
+        template<class F> size_t replay( F f ) const;
+
+        /** Discards all the records. */
+        void reset();
+
+        /** Number of records in the journal. */
+        size_t size() const { return this->header->count.load( std::memory_order_acquire ); }
+
+    private:
+        /** Placed at the beginning of the file, followed by the records. */
+        struct Header {
+            uint64_t magic;
+            uint64_t record_size;
+            uint64_t capacity;
+            std::atomic<uint64_t> count;
+        };
+
+        static const uint64_t MAGIC = 0x4c4e524a5643; /* "CVJRNL" */
+
+        /** Size of the header rounded so the records are aligned. */
+        static constexpr size_t HEADER_SIZE = ( sizeof( Header ) + alignof( T ) - 1 ) / alignof( T ) * alignof( T );
+
+        static size_t file_size( size_t capacity ) { return HEADER_SIZE + capacity * sizeof( T ); }
+        void sync( size_t from, size_t to );
+        void write_back( size_t from, size_t to );
+
+        std::string filename;
+        size_t group;
+        /** Kept open to start the writes of the group commits. */
+        int fd{ -1 };
+        size_t length{ 0 };
+        char* mem{ nullptr };
+        Header* header{ nullptr };
+        T* records{ nullptr };
+
+        /** Records already flushed. */
+        size_t synced{ 0 };
+    };
+}
+
+/**
+ * Implementation
+ */
+
+
+template <class T> const size_t IPC::Journal<T>::DEFAULT_GROUP;
+template <class T> const uint64_t IPC::Journal<T>::MAGIC;
+template <class T> constexpr size_t IPC::Journal<T>::HEADER_SIZE;
+
+
+/**
+ * Creates the segment file. If the file already has a journal of the same type, the records are
+ * kept so they can be replayed.
+ *
+ * \param filename Name of the segment file.
+ * \param capacity Maximum number of records.
+ */
+template <class T> void IPC::Journal<T>::Create( const std::string& filename, size_t capacity ) {
+    int fd = open( filename.c_str(), O_RDWR | O_CREAT, 0644 );
+    if( fd < 0 )
+        throw IPC::Journal<T>::Error( "open: " + static_cast<std::string>( strerror( errno ) ) );
+
+    Header header;
+    ssize_t n = pread( fd, &header, sizeof( Header ), 0 );
+    bool valid = ( n == sizeof( Header ) && header.magic == MAGIC && header.record_size == sizeof( T ) );
+
+    /* keeps the records if the segment is valid (only grows it) */
+    size_t records = ( valid ? header.count.load() : 0 );
+    if( valid && header.capacity > capacity ) {
+        capacity = header.capacity;
+    }
+
+    header.magic = MAGIC;
+    header.record_size = sizeof( T );
+    header.capacity = capacity;
+    header.count.store( records );
+
+    if( ftruncate( fd, file_size( capacity ) ) < 0 || pwrite( fd, &header, sizeof( Header ), 0 ) != sizeof( Header ) ) {
+        std::string error = strerror( errno );
+        close( fd );
+        throw IPC::Journal<T>::Error( "journal " + filename + ": " + error );
+    }
+
+    close( fd );
+    LOG_DBG << "journal " << filename << ": " << records << " records" << std::endl;
+}
+
+/**
+ * Removes the segment file.
+ */
+template <class T> void IPC::Journal<T>::Destroy( const std::string& filename ) {
+    if( unlink( filename.c_str() ) < 0 )
+        LOG_DBG << "unlink: " << strerror( errno ) << std::endl;
+    LOG_DBG << "destroy " << filename << std::endl;
+}
+
+
+/**
+ * Journal constructor implementation.
+ */
+template <class T> IPC::Journal<T>::Journal( const std::string& filename ) : Journal(filename, DEFAULT_GROUP) {
+}
+
+template <class T> IPC::Journal<T>::Journal( const std::string& filename, size_t group ) : filename(filename),
+                                                                                         group(group) {
+    int fd = open( this->filename.c_str(), O_RDWR );
+    if( fd < 0 )
+        throw IPC::Journal<T>::Error( "open: " + static_cast<std::string>( strerror( errno ) ) );
+
+    struct stat info;
+    if( fstat( fd, &info ) < 0 ) {
+        close( fd );
+        throw IPC::Journal<T>::Error( "fstat: " + static_cast<std::string>( strerror( errno ) ) );
+    }
+
+    this->length = info.st_size;
+    void* mem = mmap( nullptr, this->length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0 );
+    if( mem == MAP_FAILED ) {
+        close( fd );
+        throw IPC::Journal<T>::Error( "mmap: " + static_cast<std::string>( strerror( errno ) ) );
+    }
+    this->fd = fd;
+
+    this->mem = static_cast<char*>( mem );
+    this->header = reinterpret_cast<Header*>( this->mem );
+    this->records = reinterpret_cast<T*>( this->mem + HEADER_SIZE );
+
+    if( this->length < HEADER_SIZE || this->header->magic != MAGIC || this->header->record_size != sizeof( T ) ) {
+        munmap( this->mem, this->length );
+        close( this->fd );
+        throw IPC::Journal<T>::Error( "journal " + this->filename + ": bad segment" );
+    }
+
+    this->synced = this->size();
+}
+
+/**
+ * Journal destructor implementation.
+ */
+template <class T> IPC::Journal<T>::~Journal() {
+    if( this->mem == nullptr ) {
+        return;
+    }
+
+    this->commit();
+    munmap( this->mem, this->length );
+    close( this->fd );
+    this->mem = nullptr;
+}
+
+
+/**
+ * Appends records to the journal.
+ *
+ * \param elems Records to append.
+ * \param n     Number of records.
+ * \return \c false if there's no space for the records.
+ */
+template <class T> bool IPC::Journal<T>::append( const T* elems, size_t n ) {
+    size_t count = this->header->count.load( std::memory_order_relaxed );
+    if( count + n > this->header->capacity ) {
+        return false;
+    }
+
+    memcpy( &this->records[count], elems, n * sizeof( T ) );
+
+    /* the records are visible to the replay only after they are complete */
+    this->header->count.store( count + n, std::memory_order_release );
+
+    /* group commit: starts the write of the pending records without waiting */
+    if( count + n - this->synced >= this->group ) {
+        this->write_back( this->synced, count + n );
+        this->synced = count + n;
+    }
+    return true;
+}
+
+/**
+ * Writes all the records appended to the disk, waiting for it to finish.
+ */
+template <class T> void IPC::Journal<T>::commit() {
+    this->sync( 0, this->size() );
+    this->synced = this->size();
+}
+
+/**
+ * Reads the journal from the beginning.
+ *
+ * \param f Function called with each record.
+ * \return Number of records read.
+ */
+template <class T> template <class F> size_t IPC::Journal<T>::replay( F f ) const {
+    size_t count = this->size();
+    for( size_t i = 0; i < count; i++ ) {
+        f( this->records[i] );
+    }
+    return count;
+}
+
+template <class T> void IPC::Journal<T>::reset() {
+    this->header->count.store( 0, std::memory_order_release );
+    this->sync( 0, 0 );
+    this->synced = 0;
+}
+
+
+/**
+ * Flushes the pages with the header and the records in [from, to), waiting for the disk.
+ */
+template <class T> void IPC::Journal<T>::sync( size_t from, size_t to ) {
+    size_t page = sysconf( _SC_PAGESIZE );
+
+    /* the header is always flushed since it has the counter */
+    if( msync( this->mem, page, MS_SYNC ) < 0 )
+        LOG_DBG << "msync: " << strerror( errno ) << std::endl;
+
+    size_t begin = ( HEADER_SIZE + from * sizeof( T ) ) / page * page;
+    size_t end = HEADER_SIZE + to * sizeof( T );
+    if( end > begin && msync( this->mem + begin, end - begin, MS_SYNC ) < 0 )
+        LOG_DBG << "msync: " << strerror( errno ) << std::endl;
+}
+
+/**
+ * Starts writing the records in [from, to) and the header to the disk without waiting (on Linux
+ * \c msync with \c MS_ASYNC does not write anything).
+ */
+template <class T> void IPC::Journal<T>::write_back( size_t from, size_t to ) {
+    size_t begin = HEADER_SIZE + from * sizeof( T );
+    size_t end = HEADER_SIZE + to * sizeof( T );
+
+    if( sync_file_range( this->fd, begin, end - begin, SYNC_FILE_RANGE_WRITE ) < 0 ||
+        sync_file_range( this->fd, 0, sizeof( Header ), SYNC_FILE_RANGE_WRITE ) < 0 )
+        LOG_DBG << "sync_file_range: " << strerror( errno ) << std::endl;
+}
+
+
+#endif
@@ -1,5 +1,7 @@
 /* include area */
 #include "log.hpp"
+#include "log_ring.hpp"
+#include <algorithm>
 #include <errno.h>
 #include <string>
 #include <string.h>
@@ -8,6 +10,13 @@
 
 using std::string;
 using IPC::Lock;
+using IPC::LogRings;
+
+
+/** The collector writes the messages older than this, so the ones of all the processes are sorted. */
+static const uint64_t COLLECT_HOLD_NS = 20000000;
+/** Period of the collector. */
+static const long COLLECT_PERIOD_NS = 5000000;
 
 
 /**
@@ -15,20 +24,35 @@ using IPC::Lock;
  * 
  * \param other Instance to take resources from.
  */
-LogStream::LogStream( LogStream&& other ) : lock(std::move(other.lock)), streams(other.streams) {
+LogStream::LogStream( LogStream&& other ) : log(other.log), buffer(std::move(other.buffer)), active(other.active) {
+    other.active = false;
+}
+
+/**
+ * Writes the message, unless it was moved to another stream.
+ */
+LogStream::~LogStream() {
+    if( this->active ) {
+        this->log->write( this->buffer.str() );
+    }
 }
 
 
 LogStream LogStream::operator<<( std::ostream& ( *manipulator )( std::ostream& ) ) {
-    for( const auto s: this->streams ) {
-        *s << manipulator;
+    if( !this->log->streams.empty() ) {
+        this->buffer << manipulator;
     }
     return std::move( *this );
 }
 
 LogStream& LogStream::operator=( LogStream&& other ) {
-    this->lock = std::move( other.lock );
-    this->streams = other.streams;
+    if( this->active ) {
+        this->log->write( this->buffer.str() );
+    }
+    this->log = other.log;
+    this->buffer = std::move( other.buffer );
+    this->active = other.active;
+    other.active = false;
     return *this;
 }
 
@@ -52,19 +76,6 @@ Log::Log() {
     }
 }
 
-/**
- * Messages streamed through this method are logged as \c Log::Level::debug.
- */
-Log& Log::debug() {
-    /* if debug messages are to be ignored, returns a dummy log */
-    if( this->level < Log::Level::debug ) {
-        static Log dummy{};
-        dummy.remove_listeners();
-        return dummy;
-    }
-    return *this;
-}
-
 /**
  * Destructor implementation.
  */
@@ -103,10 +114,84 @@ void Log::remove_listeners() {
 }
 
 
+bool Log::use_rings( const string& name ) {
+    try {
+        this->rings.reset( new LogRings{ name } );
+    } catch( const IPC::SharedMemError& e ) {
+        return false;
+    }
+    return true;
+}
+
+/**
+ * The messages already in the ring are still written out by the collector.
+ */
+void Log::drop_rings() {
+    this->rings.reset();
+}
+
+/**
+ * Drains the rings periodically. The messages are held for a while before being written, so the
+ * late messages of other processes can still be sorted in.
+ */
+void Log::collect( const std::function<bool()>& done ) {
+    std::vector<LogRings::Message> pending;
+    auto older = []( const LogRings::Message& a, const LogRings::Message& b ) { return a.timestamp < b.timestamp; };
+
+    while( true ) {
+        /* checked before draining, so the last pass sees every message */
+        bool last = done();
+
+        this->rings->drain( pending );
+        std::stable_sort( pending.begin(), pending.end(), older );
+
+        uint64_t limit = last ? UINT64_MAX : LogRings::now() - COLLECT_HOLD_NS;
+        auto end = std::find_if( pending.begin(), pending.end(), [limit]( const LogRings::Message& m ) {
+            return m.timestamp > limit;
+        } );
+        if( end != pending.begin() ) {
+            Lock lock{ this->fd, Lock::Mode::write };
+            for( auto it = pending.begin(); it != end; it++ ) {
+                this->write_listeners( it->text );
+            }
+        }
+        pending.erase( pending.begin(), end );
+
+        if( last ) {
+            return;
+        }
+        struct timespec ts{ 0, COLLECT_PERIOD_NS };
+        nanosleep( &ts, nullptr );
+    }
+}
+
+
 /**
  * Implementation of the output operator for stream manipulators.
  */
 LogStream Log::operator<<( std::ostream& ( *manipulator )( std::ostream& ) ) {
+    return LogStream{ *this } << manipulator;
+}
+
+/**
+ * Writes a message to the ring of this process or, if there is none, to the listeners holding the
+ * lock of the log.
+ */
+void Log::write( const string& text ) {
+    if( this->streams.empty() || text.empty() ) {
+        return;
+    }
+    if( this->rings && this->rings->write( LogRings::now(), text ) ) {
+        return;
+    }
+
     Lock lock{ this->fd, Lock::Mode::write };
-    return LogStream{ this->streams, std::move( lock ) } << manipulator;
+    this->write_listeners( text );
+}
+
+void Log::write_listeners( const string& text ) {
+    for( const auto s: this->streams ) {
+        *s << text;
+        s->flush();
+    }
 }
@@ -1,5 +1,7 @@
 /**
  * An IPC secure log.
+ * The messages are formatted by each process and written in a single step: in the process ring (if
+ * the log uses rings, see \c Log::use_rings) or directly, holding the lock of the log.
  */
 
 #ifndef LOG_HPP
@@ -9,7 +11,10 @@
 /* include area */
 #include "str_utils.hpp"
 #include "lock.hpp"
+#include <functional>
 #include <iostream>
+#include <memory>
+#include <sstream>
 #include <stdio.h>
 #include <string>
 #include <unistd.h>
@@ -21,6 +26,22 @@
 #  define LOG_LOCK_FILE "/tmp/cv_log.lck"
 #endif
 
+/** Shared memory object with the rings of the processes. */
+#ifndef LOG_RINGS
+#  define LOG_RINGS "/cv_log"
+#endif
+
+/**
+ * Lowest level of the messages compiled in: with \c LOG_LEVEL_NORMAL (-DLOG_MIN_LEVEL=1) the
+ * \c LOG_DBG statements are dead code and the optimizer removes them.
+ */
+#define LOG_LEVEL_DEBUG 0
+#define LOG_LEVEL_NORMAL 1
+
+#ifndef LOG_MIN_LEVEL
+#  define LOG_MIN_LEVEL LOG_LEVEL_DEBUG
+#endif
+
 /** Internal macro to show information about the process logging the message. */
 #define MSG_INFO "(" << getpid() << ") " __FILE__ ":" XSTR( __LINE__ )
 
@@ -31,38 +52,56 @@
  * Examples:
  *
  *   LOG << "message: " << 123 << std::endl;
+ *
+ * The level is checked first: if the message is not logged, nothing after \c LOG is evaluated
+ * (the statement runs at most once, and it's safe in an \c if without braces).
  */
-#define LOG Log::get_instance() << GREEN_TEXT( MSG_INFO )
+#define LOG \
+    for( bool _log_on = Log::get_instance().enabled( Log::Level::normal ); _log_on; _log_on = false ) \
+        Log::get_instance() << GREEN_TEXT( MSG_INFO )
 
 /**
  * Short access to the global log to print debug messages.
- * Same usage as \c LOG.
+ * Same usage as \c LOG (the statement is removed if \c LOG_MIN_LEVEL is above debug).
  */
-#define LOG_DBG Log::get_instance().debug() << BLUE_TEXT( MSG_INFO ) 
+#define LOG_DBG \
+    for( bool _log_on = ( LOG_MIN_LEVEL <= LOG_LEVEL_DEBUG && Log::get_instance().enabled( Log::Level::debug ) ); _log_on; _log_on = false ) \
+        Log::get_instance() << BLUE_TEXT( MSG_INFO )
+
+
+/** Forward declaration. */
+class Log;
+namespace IPC {
+    class LogRings;
+}
 
 
 /**
  * Object to stream data into the log singleton.
+ * The message is kept until the stream is destroyed and then written to the log at once.
  */
 class LogStream {
     friend class Log;
 
 public:
     LogStream( LogStream&& other );
-    ~LogStream() {}
+    ~LogStream();
 
     template <typename T> LogStream operator<<( const T& t );
     LogStream& operator=( LogStream&& other );
     LogStream operator<<( std::ostream& ( *manipulator )( std::ostream& ) );
     
 private:
-    LogStream( std::vector<std::ostream *>& streams, IPC::Lock&& lock ) : lock(std::move(lock)), streams(streams) {}
+    LogStream( Log& log ) : log(&log) {}
     LogStream( const LogStream& other ) = delete;
     LogStream& operator=( const LogStream& other ) = delete;
 
-    /** list of streams to output. */
-    IPC::Lock lock;
-    std::vector<std::ostream *>& streams;
+    /** Log where the message is written. */
+    Log* log;
+    /** The message formatted so far. */
+    std::ostringstream buffer;
+    /** \c false once moved (the message belongs to another stream). */
+    bool active{ true };
 };
 
 
@@ -70,6 +109,7 @@ private:
  * Log singleton.
  */
 class Log {
+    friend class LogStream;
 
 public:
     /** Log level manipulator. */
@@ -89,8 +129,25 @@ public:
     void add_listener( std::ostream& os );
     void remove_listeners();
 
-    /** Used to log debug messages. */
-    Log& debug();
+    /**
+     * Writes the messages of this process in a ring of the shared memory object \a name,
+     * instead of taking the lock of the log. The messages are written out by \c collect.
+     *
+     * \return \c false if the rings don't exist (the log is used as before).
+     */
+    bool use_rings( const std::string& name );
+
+    /** Stops using the rings: the next messages are written to the listeners directly. */
+    void drop_rings();
+
+    /**
+     * Writes the messages of the rings to the listeners, in timestamp order, until \a done
+     * returns \c true (the messages left are written before returning).
+     */
+    void collect( const std::function<bool()>& done );
+
+    /** Returns \c true if the messages of \a level are written (checked before formatting them). */
+    bool enabled( Level level ) const { return level <= this->level && !this->streams.empty(); }
     
     /** Output operator to give the log an \a ostream interface. */
     template <typename T> LogStream operator<<( const T& t );
@@ -103,9 +160,16 @@ private:
     Log();
     Log( Log& log ) = delete;
 
+    /** Writes a whole message. */
+    void write( const std::string& text );
+    void write_listeners( const std::string& text );
+
     /** Vector containing the other streams that the log writes to. */
     std::vector<std::ostream *> streams{};
 
+    /** Rings of the processes (\c nullptr if not used). */
+    std::unique_ptr<IPC::LogRings> rings;
+
     /** Log file descriptor. */
     int fd;
 };
@@ -113,24 +177,20 @@ private:
 
 
 /**
- * Redirects output to all the streams in the internal list.
+ * Adds the object to the message (if the log has listeners).
  * 
  * \param t Object to stream.
  * \return Itself.
  */
 template <typename T> LogStream LogStream::operator<<( const T& t ) {
-    for( const auto s: this->streams ) {
-        *s << t;
+    if( !this->log->streams.empty() ) {
+        this->buffer << t;
     }
     return std::move( *this );
 }
 
 template <typename T> LogStream Log::operator<<( const T& t ) {    
-    /* creates a LogStream and returns it.
-     * The LogStream will hold the lock until destroyed so no other process will be able to use
-     * the log. */
-    IPC::Lock lock{ this->fd, IPC::Lock::Mode::write };
-    return LogStream{ this->streams, std::move( lock ) } << t;
+    return LogStream{ *this } << t;
 }
 
 
@@ -0,0 +1,188 @@
+/* include area */
+#include "log_ring.hpp"
+#include <algorithm>
+#include <pthread.h>
+#include <signal.h>
+#include <time.h>
+
+using std::string;
+using IPC::LogRings;
+using IPC::MapOptions;
+
+
+const size_t LogRings::RINGS;
+const size_t LogRings::RECORDS;
+const size_t LogRings::TEXT_SIZE;
+
+/** Times the writer waits for the collector when its ring is full. */
+static const int FULL_RETRIES = 50;
+static const long FULL_SLEEP_NS = 1000000;
+
+
+/**
+ * PID of this process, kept up to date in the forked children without a system call per message.
+ */
+static pid_t& _pid() {
+    static pid_t pid = getpid();
+    static bool registered = false;
+
+    if( !registered ) {
+        pthread_atfork( nullptr, nullptr, [](){ _pid() = getpid(); } );
+        registered = true;
+    }
+    return pid;
+}
+
+static bool _alive( pid_t pid ) {
+    return ( kill( pid, 0 ) == 0 || errno != ESRCH );
+}
+
+
+/**
+ * Creates the rings (all of them free).
+ *
+ * \param name Name of the shared memory object.
+ */
+void LogRings::Create( const string& name ) {
+    /* the memory is filled with zeros: no owners and empty rings */
+    IPC::MappedMem<Ring>::Create( name, RINGS, MapOptions::none );
+}
+
+void LogRings::Destroy( const string& name ) {
+    IPC::MappedMem<Ring>::Destroy( name );
+}
+
+
+/**
+ * Constructor implementation.
+ */
+LogRings::LogRings( const string& name ) : mem(name, RINGS, MapOptions::none) {
+}
+
+/**
+ * Destructor implementation: frees the ring of this process.
+ */
+LogRings::~LogRings() {
+    if( this->own != nullptr && this->own_pid == _pid() ) {
+        int32_t expected = this->own_pid;
+        this->own->owner.compare_exchange_strong( expected, 0 );
+    }
+}
+
+
+uint64_t LogRings::now() {
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return static_cast<uint64_t>( ts.tv_sec ) * 1000000000 + ts.tv_nsec;
+}
+
+
+/**
+ * Takes a free ring for this process (a forked child takes a new one).
+ *
+ * \return The ring or \c nullptr if all of them are taken.
+ */
+LogRings::Ring* LogRings::claim() {
+    pid_t pid = _pid();
+    if( this->own != nullptr && this->own_pid == pid ) {
+        return this->own;
+    }
+
+    this->own = nullptr;
+    for( size_t i = 0; i < RINGS; i++ ) {
+        int32_t expected = 0;
+        if( this->mem[i].owner.compare_exchange_strong( expected, pid ) ) {
+            this->own = &this->mem[i];
+            this->own_pid = pid;
+            break;
+        }
+    }
+    return this->own;
+}
+
+/**
+ * Copies the message in consecutive records and publishes them at once, so the collector never
+ * sees part of a message. Messages longer than the ring are truncated.
+ */
+bool LogRings::write( uint64_t timestamp, const string& text ) {
+    Ring* ring = this->claim();
+    if( ring == nullptr ) {
+        return false;
+    }
+
+    size_t count = std::min( std::max<size_t>( 1, ( text.size() + TEXT_SIZE - 1 ) / TEXT_SIZE ), RECORDS );
+    uint64_t head = ring->head.load( std::memory_order_relaxed );
+
+    int retries = 0;
+    while( head + count - ring->tail.load( std::memory_order_acquire ) > RECORDS ) {
+        if( retries++ == FULL_RETRIES ) {
+            ring->dropped.fetch_add( 1, std::memory_order_relaxed );
+            return true;
+        }
+        struct timespec ts{ 0, FULL_SLEEP_NS };
+        nanosleep( &ts, nullptr );
+    }
+
+    for( size_t i = 0; i < count; i++ ) {
+        Record& r = ring->records[( head + i ) % RECORDS];
+        size_t offset = i * TEXT_SIZE;
+        size_t length = std::min( text.size() - std::min( offset, text.size() ), TEXT_SIZE );
+
+        r.timestamp = timestamp;
+        r.pid = this->own_pid;
+        r.length = static_cast<uint16_t>( length );
+        r.more = ( i + 1 < count );
+        text.copy( r.text, length, offset );
+    }
+    ring->head.store( head + count, std::memory_order_release );
+    return true;
+}
+
+/**
+ * Takes the messages of all the rings. The rings of the processes that died are freed once they
+ * are empty.
+ */
+void LogRings::drain( std::vector<Message>& messages ) {
+    for( size_t i = 0; i < RINGS; i++ ) {
+        Ring& ring = this->mem[i];
+        pid_t owner = ring.owner.load( std::memory_order_acquire );
+        uint64_t tail = ring.tail.load( std::memory_order_relaxed );
+        uint64_t head = ring.head.load( std::memory_order_acquire );
+
+        while( tail < head ) {
+            const Record& first = ring.records[tail % RECORDS];
+            Message m{ first.timestamp, first.pid, string{} };
+
+            bool more = true;
+            while( more ) {
+                const Record& r = ring.records[tail++ % RECORDS];
+                m.text.append( r.text, r.length );
+                more = r.more;
+            }
+            messages.push_back( std::move( m ) );
+        }
+        ring.tail.store( tail, std::memory_order_release );
+
+        uint64_t dropped = ring.dropped.load( std::memory_order_relaxed );
+        if( dropped != ring.reported ) {
+            messages.push_back( Message{ LogRings::now(), owner, "(" + std::to_string( owner ) + ") " +
+                                         std::to_string( dropped - ring.reported ) + " log messages dropped\n" } );
+            ring.reported = dropped;
+        }
+
+        if( owner != 0 && !_alive( owner ) && ring.head.load( std::memory_order_acquire ) == tail ) {
+            ring.owner.compare_exchange_strong( owner, 0 );
+        }
+    }
+}
+
+size_t LogRings::writers( pid_t self, pid_t parent ) {
+    size_t n = 0;
+    for( size_t i = 0; i < RINGS; i++ ) {
+        pid_t owner = this->mem[i].owner.load( std::memory_order_acquire );
+        if( owner != 0 && owner != self && owner != parent && _alive( owner ) ) {
+            n++;
+        }
+    }
+    return n;
+}
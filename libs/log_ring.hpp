@@ -0,0 +1,97 @@
+#ifndef LOG_RING_HPP
+#define LOG_RING_HPP
+
+/* include area */
+#include "ipc.hpp"
+#include "mapped_mem.hpp"
+#include <atomic>
+#include <stdint.h>
+#include <string>
+#include <sys/types.h>
+#include <vector>
+
+
+namespace IPC {
+
+    /**
+     * Shared memory rings where the processes leave their log messages.
+     * Each process takes a ring of its own the first time it writes, so writing a message is a
+     * copy and an atomic store (there is a single writer and a single reader per ring). The
+     * messages are made of fixed size records; the longer ones take many consecutive records.
+     * A single collector drains the rings (see \c Log::collect).
+     */
+    class LogRings {
+    public:
+        /** Number of rings (processes that can log at the same time). */
+        static const size_t RINGS = 64;
+        /** Records of each ring. */
+        static const size_t RECORDS = 256;
+        /** Bytes of text of a record. */
+        static const size_t TEXT_SIZE = 240;
+
+        /** A message taken from a ring. */
+        struct Message {
+            uint64_t timestamp;
+            pid_t pid;
+            std::string text;
+        };
+
+        static void Create( const std::string& name );
+        static void Destroy( const std::string& name );
+
+        LogRings( const std::string& name );
+        ~LogRings();
+
+        /** Nanoseconds of the monotonic clock (the same for all the processes). */
+        static uint64_t now();
+
+        /**
+         * Writes a message in the ring of this process. If the ring is full, waits a while for
+         * the collector and then drops the message.
+         *
+         * \return \c false if there is no ring free for this process.
+         */
+        bool write( uint64_t timestamp, const std::string& text );
+
+        /** Takes the messages written so far (appended to \a messages). Used by the collector. */
+        void drain( std::vector<Message>& messages );
+
+        /** Number of rings taken by live processes, other than \a self and \a parent. */
+        size_t writers( pid_t self, pid_t parent );
+
+    private:
+        struct Record {
+            uint64_t timestamp;
+            int32_t pid;
+            uint16_t length;
+            /** Set if the next record continues the message. */
+            uint16_t more;
+            char text[TEXT_SIZE];
+        };
+
+        struct Ring {
+            /** PID of the process that writes the ring (0 if it's free). */
+            std::atomic<int32_t> owner;
+            /** Messages dropped because the ring was full. */
+            std::atomic<uint64_t> dropped;
+            /** Records written (only the owner changes it). */
+            alignas( 64 ) std::atomic<uint64_t> head;
+            /** Records read (only the collector changes it). */
+            alignas( 64 ) std::atomic<uint64_t> tail;
+            /** Dropped messages already reported by the collector. */
+            uint64_t reported;
+            Record records[RECORDS];
+        };
+
+        Ring* claim();
+
+        IPC::MappedMem<Ring> mem;
+
+        /** Ring of this process. */
+        Ring* own{ nullptr };
+        pid_t own_pid{ 0 };
+    };
+}
+
+
+#endif
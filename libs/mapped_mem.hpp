@@ -0,0 +1,307 @@
+#ifndef MAPPED_MEM_HPP
+#define MAPPED_MEM_HPP
+
+/* include area */
+#include "ipc.hpp"
+#include "log.hpp"
+#include "shared_mem.hpp"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using std::size_t;
+
+
+namespace IPC {
+
+    /**
+     * Options used when mapping a segment.
+     */
+    enum class MapOptions {
+        none = 0,
+        /** Maps all the pages when attaching, so the first accesses do not fault. */
+        prefault = 1,
+        /** Asks for (transparent) huge pages, so a large segment uses less TLB entries. */
+        huge_pages = 2,
+    };
+
+    inline MapOptions operator|( MapOptions a, MapOptions b ) {
+        return static_cast<MapOptions>( static_cast<int>( a ) | static_cast<int>( b ) );
+    }
+
+    inline bool operator&( MapOptions a, MapOptions b ) {
+        return ( static_cast<int>( a ) & static_cast<int>( b ) ) != 0;
+    }
+
+    /**
+     * Same as \c SharedMem but the segment is a POSIX shared memory object (it can be inspected
+     * in /dev/shm) mapped with \c mmap, so the mapping can be prefaulted and backed by huge pages.
+     * The name of the object is derived from the key (see \c Name).
+     */
+    template <typename T> class MappedMem {
+    public:
+
+        /** Size of a huge page (segments that ask for huge pages are rounded to it). */
+        static const size_t HUGE_PAGE_SIZE = 2 * 1024 * 1024;
+
+        /** Static methods to create and destroy shared memory resources. */
+        static void Create( IPC::Key key, size_t n );
+        static void Create( IPC::Key key, size_t n, MapOptions options );
+        static void Create( const std::string& name, size_t n, MapOptions options );
+        static void Destroy( IPC::Key key );
+        static void Destroy( const std::string& name );
+
+        /** Name of the shared memory object of the key. */
+        static std::string Name( IPC::Key key );
+
+        /** Class methods. */
+        MappedMem( IPC::Key key, size_t n );
+        MappedMem( IPC::Key key, size_t n, MapOptions options );
+        MappedMem( IPC::Key key );
+        MappedMem( const std::string& name, size_t n, MapOptions options );
+        ~MappedMem();
+
+        MappedMem( const MappedMem& other ) = delete;
+        MappedMem( MappedMem&& other );
+        MappedMem& operator=( const MappedMem& other ) = delete;
+        MappedMem& operator=( MappedMem&& other );
+
+        void write( size_t index, const T* elems, size_t num_elems );
+        void read( size_t index, T* elems, size_t num_elems );
+
+        /** Returns a pointer to the given index */
+        T* get_ptr( size_t index );
+
+        /** Initializes allocated memory with zeros. */
+        void set_zero();
+
+        /** Returns the number of elements allocated. */
+        size_t size() const { return this->n; }
+
+        /** Derreference operator so this class simulates a pointer. */
+        T& operator*() { return *this->data; }
+        T* operator->() { return this->data; }
+        T& operator[]( size_t index ) { return this->data[index]; }
+
+    private:
+        void map( const std::string& name, size_t n, MapOptions options );
+
+        /** pointer to the data */
+        T* data{ nullptr };
+        /** Number of elements allocated. */
+        size_t n{ 0 };
+        /** Bytes mapped. */
+        size_t length{ 0 };
+    };
+}
+
+
+/**
+ * Implementation
+ */
+
+
+template <typename T> const size_t IPC::MappedMem<T>::HUGE_PAGE_SIZE;
+
+
+template <typename T> std::string IPC::MappedMem<T>::Name( IPC::Key key ) {
+    char name[32];
+    snprintf( name, sizeof( name ), "/cv_%08x", static_cast<unsigned>( key.value ) );
+    return name;
+}
+
+/**
+ * Creates a shared memory object with space for \a n elements (initialized with zeros).
+ *
+ * \param name    Name of the object.
+ * \param n       Number of elements.
+ * \param options With \c huge_pages the size is rounded to a multiple of \c HUGE_PAGE_SIZE.
+ */
+template <typename T> void IPC::MappedMem<T>::Create( const std::string& name, size_t n, MapOptions options ) {
+    int fd = shm_open( name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0644 );
+    if( fd < 0 )
+        throw IPC::SharedMemError( "create shm_open: " + static_cast<std::string>( strerror( errno ) ) );
+
+    size_t length = sizeof( T ) * n;
+    if( options & MapOptions::huge_pages ) {
+        length = ( length + HUGE_PAGE_SIZE - 1 ) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE;
+    }
+
+    if( ftruncate( fd, length ) < 0 ) {
+        std::string error = strerror( errno );
+        close( fd );
+        shm_unlink( name.c_str() );
+        throw IPC::SharedMemError( "ftruncate: " + error );
+    }
+
+    close( fd );
+    LOG_DBG << "new mapped mem: " << name << " (" << length << " bytes)" << std::endl;
+}
+
+template <typename T> void IPC::MappedMem<T>::Create( IPC::Key key, size_t n, MapOptions options ) {
+    MappedMem<T>::Create( MappedMem<T>::Name( key ), n, options );
+}
+
+template <typename T> void IPC::MappedMem<T>::Create( IPC::Key key, size_t n ) {
+    MappedMem<T>::Create( MappedMem<T>::Name( key ), n, MapOptions::none );
+}
+
+/**
+ * Destroys a shared memory object (see \c Create).
+ */
+template <typename T> void IPC::MappedMem<T>::Destroy( const std::string& name ) {
+    if( shm_unlink( name.c_str() ) < 0 ) {
+        LOG_DBG << strerror( errno ) << std::endl;
+        return;
+    }
+    LOG_DBG << "destroy: " << name << std::endl;
+}
+
+template <typename T> void IPC::MappedMem<T>::Destroy( IPC::Key key ) {
+    MappedMem<T>::Destroy( MappedMem<T>::Name( key ) );
+}
+
+
+/**
+ * Constructor implementation.
+ */
+template <typename T> IPC::MappedMem<T>::MappedMem( const std::string& name, size_t n, MapOptions options ) {
+    this->map( name, n, options );
+}
+
+template <typename T> IPC::MappedMem<T>::MappedMem( IPC::Key key, size_t n, MapOptions options ) {
+    this->map( MappedMem<T>::Name( key ), n, options );
+}
+
+template <typename T> IPC::MappedMem<T>::MappedMem( IPC::Key key, size_t n ) {
+    this->map( MappedMem<T>::Name( key ), n, MapOptions::none );
+}
+
+/**
+ * Maps the whole object (the number of elements is taken from its size).
+ */
+template <typename T> IPC::MappedMem<T>::MappedMem( IPC::Key key ) {
+    this->map( MappedMem<T>::Name( key ), 0, MapOptions::none );
+}
+
+/**
+ * Move constructor.
+ */
+template <typename T> IPC::MappedMem<T>::MappedMem( MappedMem&& other ) {
+    std::swap( this->data, other.data );
+    std::swap( this->n, other.n );
+    std::swap( this->length, other.length );
+}
+
+template <typename T> IPC::MappedMem<T>& IPC::MappedMem<T>::operator=( MappedMem&& other ) {
+    std::swap( this->data, other.data );
+    std::swap( this->n, other.n );
+    std::swap( this->length, other.length );
+    return *this;
+}
+
+/**
+ * Destructor implementation.
+ */
+template <typename T> IPC::MappedMem<T>::~MappedMem() {
+    if( this->data == nullptr )
+        return;
+
+    if( munmap( this->data, this->length ) < 0 )
+        LOG_DBG << strerror( errno ) << std::endl;
+
+    this->data = nullptr;
+}
+
+
+template <typename T> void IPC::MappedMem<T>::write( size_t index, const T* elems, size_t num_elems ) {
+    if( num_elems > this->n - index )
+        throw IPC::SharedMemError( "Out of bounds" );
+
+    memcpy( this->data + index, elems, sizeof( T ) * num_elems );
+}
+
+template <typename T> void IPC::MappedMem<T>::read( size_t index, T* elems, size_t num_elems ) {
+    if( num_elems > this->n - index )
+        throw IPC::SharedMemError( "Out of bounds" );
+
+    memcpy( elems, this->data + index, sizeof( T ) * num_elems );
+}
+
+template <typename T> T* IPC::MappedMem<T>::get_ptr( size_t index ) {
+    if( index >= this->n ) {
+        throw IPC::SharedMemError( "Out of bounds: " + std::to_string( index ) );
+    }
+    return this->data + index;
+}
+
+template <typename T> void IPC::MappedMem<T>::set_zero() {
+    memset( this->data, 0, sizeof( T ) * this->n );
+}
+
+
+/**
+ * Maps the object.
+ *
+ * \param name    Name of the object.
+ * \param n       Number of elements (0 to map the whole object).
+ * \param options Mapping options.
+ */
+template <typename T> void IPC::MappedMem<T>::map( const std::string& name, size_t n, MapOptions options ) {
+    int fd = shm_open( name.c_str(), O_RDWR, 0644 );
+    if( fd < 0 )
+        throw IPC::SharedMemError( "shm_open: " + static_cast<std::string>( strerror( errno ) ) );
+
+    struct stat info;
+    if( fstat( fd, &info ) < 0 ) {
+        close( fd );
+        throw IPC::SharedMemError( "fstat: " + static_cast<std::string>( strerror( errno ) ) );
+    }
+    if( n == 0 ) {
+        n = info.st_size / sizeof( T );
+    }
+    if( sizeof( T ) * n > static_cast<size_t>( info.st_size ) ) {
+        close( fd );
+        throw IPC::SharedMemError( "segment " + name + " is smaller than requested" );
+    }
+
+    /* the whole object is mapped, so the huge pages cover all of it */
+    this->length = info.st_size;
+
+    /* with huge pages, prefaulting waits until the advice is given */
+    int flags = MAP_SHARED;
+    bool huge_pages = ( options & MapOptions::huge_pages );
+    if( ( options & MapOptions::prefault ) && !huge_pages ) {
+        flags |= MAP_POPULATE;
+    }
+
+    void* ptr = mmap( nullptr, this->length, PROT_READ | PROT_WRITE, flags, fd, 0 );
+    close( fd );
+    if( ptr == MAP_FAILED )
+        throw IPC::SharedMemError( "mmap: " + static_cast<std::string>( strerror( errno ) ) );
+
+    this->data = static_cast<T *>( ptr );
+    this->n = n;
+
+    if( huge_pages ) {
+        /* best effort: depends on the shmem transparent huge pages setting of the system */
+        if( madvise( ptr, this->length, MADV_HUGEPAGE ) < 0 )
+            LOG_DBG << "madvise: " << strerror( errno ) << std::endl;
+
+        if( options & MapOptions::prefault ) {
+            volatile const char* bytes = static_cast<const char *>( ptr );
+            size_t page = sysconf( _SC_PAGESIZE );
+            for( size_t offset = 0; offset < this->length; offset += page ) {
+                ( void )bytes[offset];
+            }
+        }
+    }
+}
+
+
+#endif
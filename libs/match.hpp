@@ -4,6 +4,7 @@
 /* include area */
 #include "player.hpp"
 #include <iostream>
+#include <string>
 
 
 /**
@@ -61,4 +62,30 @@ struct MatchResult {
 };
 
 
+/**
+ * Credits granted by the free courts, kept in a semaphore set: the counter \c CREDITS_TOTAL holds
+ * the credits of all the rows and each row has its own counter (see \c row_credits).
+ */
+static const char CREDITS_KEY_ID = 1;
+static const size_t CREDITS_TOTAL = 0;
+
+/** Returns the index of the credits counter of a row. */
+inline size_t row_credits( int row ) {
+    return row + 1;
+}
+
+/** Key ID of the tides: a set of barriers with one barrier for each row (closed when flooded). */
+static const char TIDES_KEY_ID = 2;
+
+/**
+ * Returns the name of the queue where the matches to be played in a row are sent.
+ *
+ * \param base Name of the matches queue.
+ * \param row  Row of the courts.
+ */
+inline std::string row_queue( const std::string& base, int row ) {
+    return base + "_" + std::to_string( row );
+}
+
+
 #endif
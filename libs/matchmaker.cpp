@@ -0,0 +1,217 @@
+/* include area */
+#include "matchmaker.hpp"
+#include <algorithm>
+
+
+/**
+ * The candidates are taken in windows, so a pass costs the same with any number of players: the
+ * windows are paired one after the other until the matches are formed or every available player
+ * was a candidate.
+ */
+size_t Matchmaker::find_matches( std::vector<Match>& matches, size_t max ) {
+    matches.clear();
+
+    /* a match needs four players */
+    size_t available = this->players.available();
+    if( max == 0 || available < 4 ) {
+        return 0;
+    }
+
+    for( size_t seen = 0; matches.size() < max && seen < available; ) {
+        size_t needed = max - matches.size();
+        size_t window = CANDIDATES_PER_MATCH * needed;
+        this->players.available_players( this->ids, this->next, window );
+        if( this->ids.size() < 4 ) {
+            break;
+        }
+        seen += this->ids.size();
+        this->next = this->ids.back() + 1;
+
+        this->snapshot();
+        this->form_teams( 2 * needed );
+
+        for( size_t t = 0; t + 1 < this->teams.size() && matches.size() < max; t += 2 ) {
+            Match m{ this->teams[t], this->teams[t + 1] };
+            if( this->players.claim( { m.team1.player1, m.team1.player2, m.team2.player1, m.team2.player2 } ) ) {
+                matches.push_back( m );
+            }
+        }
+
+        /* all the available players were in the window */
+        if( this->ids.size() < window ) {
+            break;
+        }
+    }
+    return matches.size();
+}
+
+
+/**
+ * Looks for a first team and then for a second one without its players. If every other team has
+ * one of them, a match needs a different partner for each one.
+ * Each player has played with at most \c max_matches others, so the players are checked through
+ * their pairs history instead of through every other player.
+ */
+bool Matchmaker::can_form_match() {
+    if( this->players.available() < 4 ) {
+        return false;
+    }
+
+    /* the IDs are sorted */
+    this->players.available_players( this->ids );
+    size_t n = this->ids.size();
+    if( n < 4 ) {
+        return false;
+    }
+    this->snapshots.resize( n );
+    for( size_t i = 0; i < n; i++ ) {
+        this->players.snapshot( this->ids[i], this->snapshots[i] );
+    }
+
+    /* a partner is found among the first max_matches + 2 players */
+    size_t first = n, second = n;
+    for( size_t i = 0; i < n && first == n; i++ ) {
+        for( size_t j = 0; j < n; j++ ) {
+            if( j != i && !this->snapshots[i].has_played_with( this->ids[j] ) ) {
+                first = i;
+                second = j;
+                break;
+            }
+        }
+    }
+    if( first == n ) {
+        return false;
+    }
+
+    /* a partner that is not in the first team */
+    for( size_t i = 0; i < n; i++ ) {
+        if( i != first && i != second && this->played_with( i, { first, second } ) < n - 3 ) {
+            return true;
+        }
+    }
+
+    size_t a = n - 2 - this->played_with( first, { second } );
+    size_t b = n - 2 - this->played_with( second, { first } );
+
+    /* the players that are not a partner of both */
+    std::vector<player_t> either;
+    for( size_t i: { first, second } ) {
+        for( player_t other: this->snapshots[i].pairs ) {
+            if( std::binary_search( this->ids.begin(), this->ids.end(), other ) ) {
+                either.push_back( other );
+            }
+        }
+    }
+    std::sort( either.begin(), either.end() );
+    size_t both = n - 2 - ( std::unique( either.begin(), either.end() ) - either.begin() );
+
+    return a > 0 && b > 0 && !( a == 1 && b == 1 && both == 1 );
+}
+
+
+/**
+ * Counts the available players that the player \a i has played with, leaving out the \a excluded
+ * ones (indexes of \c ids, as \a i).
+ */
+size_t Matchmaker::played_with( size_t i, std::initializer_list<size_t> excluded ) {
+    size_t count = 0;
+    for( player_t other: this->snapshots[i].pairs ) {
+        bool skip = false;
+        for( size_t e: excluded ) {
+            skip = skip || ( this->ids[e] == other );
+        }
+        if( !skip && std::binary_search( this->ids.begin(), this->ids.end(), other ) ) {
+            count++;
+        }
+    }
+    return count;
+}
+
+
+/**
+ * Copies the candidates and their pairs history into the graph. The pairs are read from
+ * snapshots, so the results process is never blocked by the pass.
+ */
+void Matchmaker::snapshot() {
+    size_t n = this->ids.size();
+    this->words = ( n + 63 ) / 64;
+    this->index.clear();
+    for( size_t i = 0; i < n; i++ ) {
+        this->index[this->ids[i]] = i;
+    }
+
+    /* everyone can pair with everyone else, except with the players already played with */
+    this->graph.assign( n * this->words, ~static_cast<uint64_t>( 0 ) );
+    for( size_t i = 0; i < n; i++ ) {
+        uint64_t* row = &this->graph[i * this->words];
+        row[i / 64] &= ~( static_cast<uint64_t>( 1 ) << ( i % 64 ) );
+        if( n % 64 != 0 ) {
+            row[this->words - 1] &= ( static_cast<uint64_t>( 1 ) << ( n % 64 ) ) - 1;
+        }
+
+        this->players.snapshot( this->ids[i], this->player );
+        for( player_t other: this->player.pairs ) {
+            auto it = this->index.find( other );
+            if( it != this->index.end() ) {
+                row[it->second / 64] &= ~( static_cast<uint64_t>( 1 ) << ( it->second % 64 ) );
+            }
+        }
+    }
+}
+
+/**
+ * Pairs the players greedily: the players with fewer possible partners choose first, and each one
+ * takes the unpaired partner that has fewer possible partners itself.
+ *
+ * \param max Number of teams where the pairing stops.
+ */
+void Matchmaker::form_teams( size_t max ) {
+    size_t n = this->ids.size();
+    this->teams.clear();
+
+    this->degree.resize( n );
+    this->order.resize( n );
+    for( size_t i = 0; i < n; i++ ) {
+        size_t d = 0;
+        for( size_t w = 0; w < this->words; w++ ) {
+            d += __builtin_popcountll( this->graph[i * this->words + w] );
+        }
+        this->degree[i] = d;
+        this->order[i] = i;
+    }
+    std::sort( this->order.begin(), this->order.end(), [this]( size_t a, size_t b ) {
+        return this->degree[a] < this->degree[b];
+    } );
+
+    this->unpaired.assign( this->words, ~static_cast<uint64_t>( 0 ) );
+    if( n % 64 != 0 ) {
+        this->unpaired[this->words - 1] = ( static_cast<uint64_t>( 1 ) << ( n % 64 ) ) - 1;
+    }
+
+    for( size_t i: this->order ) {
+        if( this->teams.size() >= max ) {
+            break;
+        }
+        if( !( ( this->unpaired[i / 64] >> ( i % 64 ) ) & 1 ) ) {
+            continue;
+        }
+
+        size_t best = n;
+        for( size_t w = 0; w < this->words; w++ ) {
+            uint64_t partners = this->graph[i * this->words + w] & this->unpaired[w];
+            while( partners != 0 ) {
+                size_t j = w * 64 + __builtin_ctzll( partners );
+                partners &= partners - 1;
+                if( best == n || this->degree[j] < this->degree[best] ) {
+                    best = j;
+                }
+            }
+        }
+
+        if( best != n ) {
+            this->unpaired[i / 64] &= ~( static_cast<uint64_t>( 1 ) << ( i % 64 ) );
+            this->unpaired[best / 64] &= ~( static_cast<uint64_t>( 1 ) << ( best % 64 ) );
+            this->teams.push_back( Team{ this->ids[i], this->ids[best] } );
+        }
+    }
+}
@@ -0,0 +1,69 @@
+#ifndef MATCHMAKER_HPP
+#define MATCHMAKER_HPP
+
+/* include area */
+#include "match.hpp"
+#include "player.hpp"
+#include <initializer_list>
+#include <stdint.h>
+#include <unordered_map>
+#include <vector>
+
+
+/**
+ * Forms many matches in a single pass over the available players.
+ * A window of candidates (a few times the players needed) is taken from the index of available
+ * players and their pairs history is copied into a local graph (a bit per pair of players that
+ * have not played together yet). The candidates are paired greedily in teams (the ones with fewer
+ * possible partners first) and the teams are put together in matches. The next window starts
+ * after the last candidate, so every available player is eventually a candidate.
+ * The players of each match are claimed at once (see \c PlayersTable::claim); the matches that
+ * can't be claimed are dropped from the pass.
+ */
+class Matchmaker {
+public:
+    Matchmaker( PlayersTable& players ) : players(players) {}
+    ~Matchmaker() {}
+
+    /**
+     * Forms at most \a max matches with the available players.
+     *
+     * \param matches Where the matches are stored (it's cleared first).
+     * \param max     Maximum number of matches.
+     * \return Number of matches formed.
+     */
+    size_t find_matches( std::vector<Match>& matches, size_t max );
+
+    /**
+     * Tells if a match can be formed with the available players (none is claimed): two teams of
+     * players that have not played together, with different players.
+     */
+    bool can_form_match();
+
+    /** Number of candidates taken for each match needed. */
+    static const size_t CANDIDATES_PER_MATCH = 8;
+
+private:
+    void snapshot();
+    void form_teams( size_t max );
+    size_t played_with( size_t i, std::initializer_list<size_t> excluded );
+
+    PlayersTable& players;
+
+    /* buffers kept between passes */
+    std::vector<player_t> ids;
+    std::unordered_map<player_t, size_t> index;
+    std::vector<uint64_t> graph;
+    std::vector<size_t> degree;
+    std::vector<size_t> order;
+    std::vector<uint64_t> unpaired;
+    std::vector<Team> teams;
+    std::vector<PlayerSnapshot> snapshots;
+    PlayerSnapshot player;
+    size_t words{0};
+    /** First candidate of the next window. */
+    player_t next{1};
+};
+
+
+#endif
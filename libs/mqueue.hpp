@@ -0,0 +1,204 @@
+#ifndef MQUEUE_HPP
+#define MQUEUE_HPP
+
+/* include area */
+#include "ipc.hpp"
+#include "log.hpp"
+#include "queue.hpp"
+#include <chrono>
+#include <errno.h>
+#include <fcntl.h>
+#include <mqueue.h>
+#include <string>
+#include <string.h>
+#include <time.h>
+#include <type_traits>
+
+
+namespace IPC {
+
+    /**
+     * An inter-process queue for a specific data type T over a POSIX message queue.
+     * Has the same interface as \c IPC::Queue, but elements can be inserted with a priority (the
+     * elements with the highest priority are removed first) and the capacity is bounded by the
+     * kernel. Unlike a FIFO, the queue does not reach an end when the writers leave.
+     * The name must start with a slash (for example "/cv_matches").
+     */
+    template<class T> class MQueue {
+        static_assert( std::is_trivially_copyable<T>::value, "elements are copied between processes" );
+
+    public:
+
+        /** Default capacity (the maximum allowed to unprivileged processes by default). */
+        static const size_t DEFAULT_CAPACITY = 10;
+
+        /** Creates/destroys a MQueue that will be accessible from other modules. */
+        static void Create( const std::string& name );
+        static void Create( const std::string& name, size_t capacity );
+        static void Destroy( const std::string& name );
+
+        MQueue( const std::string& name, QueueMode mode );
+        MQueue( const std::string& name, QueueMode mode, bool uninterrupted );
+        MQueue( const MQueue& other ) = delete;
+        MQueue& operator=( const MQueue& other ) = delete;
+        ~MQueue();
+
+        void insert( T elem, unsigned int priority = 0 );
+        T remove( unsigned int* priority = nullptr );
+
+        /** Non-blocking and timed versions: return \c false if no element was read. */
+        bool try_remove( T& elem );
+        bool remove_for( T& elem, std::chrono::milliseconds timeout );
+
+    private:
+        std::string name;
+        mqd_t mqd{ -1 };
+        bool uninterrupted;
+    };
+
+}
+
+/**
+ * Implementation
+ */
+
+
+template <class T> const size_t IPC::MQueue<T>::DEFAULT_CAPACITY;
+
+
+/**
+ * Creates the MQueue so it's available to the other processes.
+ *
+ * \param name     Name of the queue.
+ * \param capacity Maximum number of elements in the queue.
+ */
+template <class T> void IPC::MQueue<T>::Create( const std::string& name, size_t capacity ) {
+    struct mq_attr attr;
+    memset( &attr, 0, sizeof( attr ) );
+    attr.mq_maxmsg = capacity;
+    attr.mq_msgsize = sizeof( T );
+
+    mqd_t mqd = mq_open( name.c_str(), O_RDONLY | O_CREAT | O_EXCL, 0644, &attr );
+    if( mqd == ( mqd_t )-1 )
+        throw IPC::QueueError( "mq_open: " + static_cast<std::string>( strerror( errno ) ) );
+
+    mq_close( mqd );
+}
+
+template <class T> void IPC::MQueue<T>::Create( const std::string& name ) {
+    MQueue<T>::Create( name, DEFAULT_CAPACITY );
+}
+
+/**
+ * Destroys the MQueue (no other processes will be able to connect again).
+ */
+template <class T> void IPC::MQueue<T>::Destroy( const std::string& name ) {
+    if( mq_unlink( name.c_str() ) < 0 )
+        LOG_DBG << "mq_unlink: " << strerror( errno ) << std::endl;
+    LOG_DBG << "destroy " << name << std::endl;
+}
+
+
+/**
+ * MQueue constructor implementation.
+ */
+template <class T> IPC::MQueue<T>::MQueue( const std::string& name, IPC::QueueMode mode ) : MQueue(name, mode, false) {
+}
+
+template <class T> IPC::MQueue<T>::MQueue( const std::string& name, IPC::QueueMode mode, bool uninterrupted ) : name(name),
+                                                                                                                uninterrupted(uninterrupted) {
+    this->mqd = mq_open( this->name.c_str(), static_cast<int>( mode ) );
+    if( this->mqd == ( mqd_t )-1 )
+        throw IPC::QueueError( "mq_open: " + static_cast<std::string>( strerror( errno ) ) );
+}
+
+/**
+ * MQueue destructor implementation.
+ */
+template <class T> IPC::MQueue<T>::~MQueue() {
+    if( this->mqd != ( mqd_t )-1 )
+        mq_close( this->mqd );
+    this->mqd = -1;
+}
+
+
+/**
+ * Inserts an element into the MQueue (blocks while it's full).
+ *
+ * \param elem     Element to insert.
+ * \param priority Elements with higher priority are removed first.
+ */
+template <class T> void IPC::MQueue<T>::insert( T elem, unsigned int priority ) {
+    while( mq_send( this->mqd, reinterpret_cast<const char *>( &elem ), sizeof( T ), priority ) < 0 ) {
+        if( errno == EINTR && this->uninterrupted ) {
+            /* retries */
+            continue;
+        }
+        throw IPC::QueueError( "mq_send: " + static_cast<std::string>( strerror( errno ) ) );
+    }
+}
+
+/**
+ * Gets the element with the highest priority from the MQueue (blocks while it's empty).
+ *
+ * \param priority If not null, stores the priority of the element.
+ * \return The element removed.
+ */
+template <class T> T IPC::MQueue<T>::remove( unsigned int* priority ) {
+    T rv;
+
+    while( mq_receive( this->mqd, reinterpret_cast<char *>( &rv ), sizeof( T ), priority ) < 0 ) {
+        if( errno == EINTR && this->uninterrupted ) {
+            /* retries */
+            continue;
+        }
+        throw IPC::QueueError( "mq_receive: " + static_cast<std::string>( strerror( errno ) ) );
+    }
+
+    return rv;
+}
+
+/**
+ * Gets an element from the MQueue only if there's one available.
+ *
+ * \param elem Where the element is stored.
+ * \return \c true if an element was read.
+ */
+template <class T> bool IPC::MQueue<T>::try_remove( T& elem ) {
+    return this->remove_for( elem, std::chrono::milliseconds( 0 ) );
+}
+
+/**
+ * Gets an element from the MQueue waiting at most \a timeout for it.
+ *
+ * \param elem    Where the element is stored.
+ * \param timeout Maximum time to wait.
+ * \return \c true if an element was read, \c false on timeout or if interrupted by a signal.
+ */
+template <class T> bool IPC::MQueue<T>::remove_for( T& elem, std::chrono::milliseconds timeout ) {
+    /* mq_timedreceive expects an absolute time */
+    struct timespec deadline;
+    clock_gettime( CLOCK_REALTIME, &deadline );
+    deadline.tv_sec += timeout.count() / 1000;
+    deadline.tv_nsec += ( timeout.count() % 1000 ) * 1000000;
+    if( deadline.tv_nsec >= 1000000000 ) {
+        deadline.tv_sec += 1;
+        deadline.tv_nsec -= 1000000000;
+    }
+
+    while( mq_timedreceive( this->mqd, reinterpret_cast<char *>( &elem ), sizeof( T ), nullptr, &deadline ) < 0 ) {
+        if( errno == EINTR && this->uninterrupted ) {
+            /* retries */
+            continue;
+        }
+        if( errno == ETIMEDOUT || errno == EINTR ) {
+            return false;
+        }
+        throw IPC::QueueError( "mq_timedreceive: " + static_cast<std::string>( strerror( errno ) ) );
+    }
+
+    return true;
+}
+
+
+#endif
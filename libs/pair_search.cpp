@@ -0,0 +1,107 @@
+/* include area */
+#include "pair_search.hpp"
+
+#if defined( __x86_64__ )
+#include <immintrin.h>
+#endif
+
+
+typedef bool ( *_Kernel )( const size_t*, size_t, size_t );
+
+static bool _contains_scalar( const size_t* pairs, size_t n, size_t id ) {
+    for( size_t i = 0; i < n; i++ ) {
+        if( pairs[i] == id ) {
+            return true;
+        }
+    }
+    return false;
+}
+
+#if defined( __x86_64__ )
+
+static_assert( sizeof( size_t ) == sizeof( int64_t ), "the kernels compare 64 bit IDs" );
+
+/**
+ * Compares 8 IDs per iteration (two vectors of 4), the remaining ones one at a time.
+ */
+__attribute__(( target( "avx2" ) ))
+static bool _contains_avx2( const size_t* pairs, size_t n, size_t id ) {
+    const __m256i key = _mm256_set1_epi64x( static_cast<int64_t>( id ) );
+
+    size_t i = 0;
+    for( ; i + 8 <= n; i += 8 ) {
+        __m256i a = _mm256_loadu_si256( reinterpret_cast<const __m256i*>( pairs + i ) );
+        __m256i b = _mm256_loadu_si256( reinterpret_cast<const __m256i*>( pairs + i + 4 ) );
+        __m256i eq = _mm256_or_si256( _mm256_cmpeq_epi64( a, key ), _mm256_cmpeq_epi64( b, key ) );
+        if( !_mm256_testz_si256( eq, eq ) ) {
+            return true;
+        }
+    }
+    return _contains_scalar( pairs + i, n - i, id );
+}
+
+/**
+ * Compares 4 IDs per iteration (two vectors of 2), the remaining ones one at a time.
+ */
+__attribute__(( target( "sse4.1" ) ))
+static bool _contains_sse41( const size_t* pairs, size_t n, size_t id ) {
+    const __m128i key = _mm_set1_epi64x( static_cast<int64_t>( id ) );
+
+    size_t i = 0;
+    for( ; i + 4 <= n; i += 4 ) {
+        __m128i a = _mm_loadu_si128( reinterpret_cast<const __m128i*>( pairs + i ) );
+        __m128i b = _mm_loadu_si128( reinterpret_cast<const __m128i*>( pairs + i + 2 ) );
+        __m128i eq = _mm_or_si128( _mm_cmpeq_epi64( a, key ), _mm_cmpeq_epi64( b, key ) );
+        if( !_mm_testz_si128( eq, eq ) ) {
+            return true;
+        }
+    }
+    return _contains_scalar( pairs + i, n - i, id );
+}
+
+#endif
+
+
+struct _Dispatch {
+    _Kernel contains;
+    const char* name;
+};
+
+/**
+ * Chooses the kernel from the features of the CPU (only once).
+ */
+static const _Dispatch& _dispatch() {
+    static const _Dispatch dispatch = []() {
+#if defined( __x86_64__ )
+        __builtin_cpu_init();
+        if( __builtin_cpu_supports( "avx2" ) ) {
+            return _Dispatch{ _contains_avx2, "avx2" };
+        }
+        if( __builtin_cpu_supports( "sse4.1" ) ) {
+            return _Dispatch{ _contains_sse41, "sse4.1" };
+        }
+#endif
+        return _Dispatch{ _contains_scalar, "scalar" };
+    }();
+    return dispatch;
+}
+
+
+bool PairSearch::contains( const size_t* pairs, size_t n, size_t id ) {
+    return _dispatch().contains( pairs, n, id );
+}
+
+size_t PairSearch::contains_many( size_t id, const size_t* const* histories, const size_t* sizes, size_t count, bool* found ) {
+    _Kernel contains = _dispatch().contains;
+
+    size_t total = 0;
+    for( size_t i = 0; i < count; i++ ) {
+        found[i] = contains( histories[i], sizes[i], id );
+        total += found[i] ? 1 : 0;
+    }
+    return total;
+}
+
+const char* PairSearch::kernel() {
+    return _dispatch().name;
+}
@@ -0,0 +1,35 @@
+#ifndef PAIR_SEARCH_HPP
+#define PAIR_SEARCH_HPP
+
+/* include area */
+#include <stddef.h>
+#include <stdint.h>
+
+
+/**
+ * Search of a player ID in the arrays with the pairs history of the players.
+ * The comparisons are done with AVX2 (4 IDs per instruction) or SSE4.1 (2 IDs per instruction)
+ * when the CPU has them, chosen the first time a search is done; otherwise a scalar loop is used.
+ */
+namespace PairSearch {
+    /** Returns \c true if \a id is one of the \a n IDs of \a pairs. */
+    bool contains( const size_t* pairs, size_t n, size_t id );
+
+    /**
+     * Looks for \a id in the histories of many players.
+     *
+     * \param id        ID searched.
+     * \param histories Pairs history of each player.
+     * \param sizes     Number of IDs of each history.
+     * \param count     Number of players.
+     * \param found     Where the result for each player is stored.
+     * \return Number of histories where \a id was found.
+     */
+    size_t contains_many( size_t id, const size_t* const* histories, const size_t* sizes, size_t count, bool* found );
+
+    /** Name of the instruction set used ("avx2", "sse4.1" or "scalar"). */
+    const char* kernel();
+}
+
+
+#endif
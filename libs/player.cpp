@@ -1,41 +1,130 @@
 /* include area */
 #include "player.hpp"
+#include "futex.hpp"
+#include "pair_search.hpp"
+#include <algorithm>
+#include <sched.h>
+
+#if defined( __x86_64__ )
+#include <immintrin.h>
+#endif
 
 using std::size_t;
 using std::string;
-using IPC::Lock;
-using IPC::SharedMem;
+using IPC::RWLock;
+using IPC::MappedMem;
+using IPC::MapOptions;
+
+
+/* each player has a lock (and its version, in the upper half of the word), it's state, the number
+ * of matches it has already played and an array of 'max_matches' (to store the IDs of the other
+ * players it has played with) */
+#define PLAYER_RECORD_SIZE( max_matches ) ( max_matches + 3 )
 
+/** Options used to map the segments. */
+static const MapOptions TABLE_OPTIONS = MapOptions::prefault | MapOptions::huge_pages;
 
-/* each player has an array of 'max_matches' (to store the IDs of the other players it
- * has played with), the number of matches it has already played and it's state.
- * an extra size_t is used by the table to hold the number of players initialized */
-#define PLAYERS_TABLE_SIZE( max_players, max_matches ) ( max_players * ( max_matches + 2 ) + 1 )
+/** Times a version is read again before giving the CPU away. */
+static const size_t VERSION_SPINS = 64;
 
 
 /**
- * Creates a shared table that holds the players state.
- * 
- * \param key The key of the shared resource.
+ * Waits a little before reading a version that is being changed again: pauses the CPU the first
+ * times, and then lets other processes run (the writer may be waiting for the CPU).
  */
-void PlayersTable::Create( IPC::Key key, size_t max_players, size_t max_matches ) {
-    
-    size_t size = PLAYERS_TABLE_SIZE( max_players, max_matches );
+static void _relax( size_t& spins ) {
+    if( ++spins < VERSION_SPINS ) {
+#if defined( __x86_64__ )
+        _mm_pause();
+#endif
+    } else {
+        sched_yield();
+    }
+}
 
-    SharedMem<size_t>::Create( key, size );
-    SharedMem<size_t> mem{ key, size };
+/**
+ * Makes the version of a record odd while it's being changed. The claims change the state without
+ * the lock of the player, so the version is taken with a compare-and-swap: two writers never bump
+ * it at once (the second one waits until it's even).
+ */
+static void _begin_write( std::atomic<uint32_t> *version ) {
+    size_t spins = 0;
+    uint32_t value = version->load( std::memory_order_relaxed );
+    while( true ) {
+        if( !( value & 1 ) && version->compare_exchange_weak( value, value + 1, std::memory_order_acquire, std::memory_order_relaxed ) ) {
+            break;
+        }
+        if( value & 1 ) {
+            _relax( spins );
+            value = version->load( std::memory_order_relaxed );
+        }
+    }
+    std::atomic_thread_fence( std::memory_order_release );
+}
 
-    /* initialize to zero */
-    mem.set_zero();
+static void _end_write( std::atomic<uint32_t> *version ) {
+    version->fetch_add( 1, std::memory_order_release );
+}
+
+
+/** Words of the bitmap of a segment of 2^bits players. */
+static size_t _bitmap_words( size_t bits ) {
+    return ( ( static_cast<size_t>( 1 ) << bits ) + 63 ) / 64;
+}
+
+/** Words of the summary of the bitmap (a bit per word of the bitmap). */
+static size_t _summary_words( size_t bits ) {
+    return ( _bitmap_words( bits ) + 63 ) / 64;
+}
+
+/** Size of a segment of 2^bits players, in words. */
+static size_t _segment_words( size_t bits, size_t record_size ) {
+    return _summary_words( bits ) + _bitmap_words( bits ) + ( record_size << bits );
+}
+
+
+/**
+ * Creates a shared table that holds the players state (with no players).
+ * 
+ * \param key         The key of the shared resource.
+ * \param max_matches Maximum number of matches of each player.
+ */
+void PlayersTable::Create( IPC::Key key, size_t max_matches ) {
+    MappedMem<Header>::Create( key, 1 );
+    MappedMem<Header> header{ key, 1 };
+
+    /* each segment (index and records) fills a huge page, with at least one player */
+    size_t bits = 0;
+    while( _segment_words( bits + 1, PLAYER_RECORD_SIZE( max_matches ) ) * sizeof( size_t ) <= MappedMem<size_t>::HUGE_PAGE_SIZE ) {
+        bits++;
+    }
+
+    header->players = 0;
+    header->segments = 0;
+    header->max_matches = max_matches;
+    header->segment_bits = bits;
+    header->available = 0;
+    header->exhausted = 0;
+    header->changes = 0;
+    header->changes_waiting = 0;
 }
 
 /**
- * Destroys the players table shared resource.
+ * Destroys the players table shared resource (and all its segments).
  * 
  * \param key The key of the shared resource.
  */
 void PlayersTable::Destroy( IPC::Key key ) {
-    SharedMem<size_t>::Destroy( key );
+    std::string name = MappedMem<Header>::Name( key );
+    try {
+        MappedMem<Header> header{ key, 1 };
+        for( size_t i = 0; i < header->segments; i++ ) {
+            MappedMem<size_t>::Destroy( PlayersTable::segment_name( name, i ) );
+        }
+    } catch( const IPC::SharedMemError& e ) {
+        LOG_DBG << e.what() << std::endl;
+    }
+    MappedMem<Header>::Destroy( key );
 }
 
 
@@ -43,9 +132,13 @@ void PlayersTable::Destroy( IPC::Key key ) {
  * Constructor implementation.
  * 
  */
-PlayersTable::PlayersTable( IPC::Key key, size_t max_players, size_t max_matches ) : max_players(max_players),
-                                                                                                     max_matches(max_matches),
-                                                                                                     storage(key, PLAYERS_TABLE_SIZE( max_players, max_matches ) ) {
+PlayersTable::PlayersTable( IPC::Key key ) : name(MappedMem<Header>::Name( key )),
+                                             header(key, 1) {
+    this->max_matches = this->header->max_matches;
+    this->segment_bits = this->header->segment_bits;
+    this->record_size = PLAYER_RECORD_SIZE( this->max_matches );
+    this->summary_words = _summary_words( this->segment_bits );
+    this->index_words = this->summary_words + _bitmap_words( this->segment_bits );
 }
 
 /**
@@ -55,19 +148,31 @@ PlayersTable::~PlayersTable() {
 }
 
 /**
- * Adds a new player.
+ * Adds a new player, creating a new segment if the last one is full.
  */
 void PlayersTable::add_player() {
-    player_t id = ++this->storage[0];
+    player_t id = this->header->players.load( std::memory_order_relaxed ) + 1;
+
+    size_t index = ( id - 1 ) >> this->segment_bits;
+    if( index >= this->header->segments.load( std::memory_order_relaxed ) ) {
+        /* the segment is filled with zeros: the index is empty */
+        MappedMem<size_t>::Create( PlayersTable::segment_name( this->name, index ), _segment_words( this->segment_bits, this->record_size ), TABLE_OPTIONS );
+        this->header->segments.store( index + 1, std::memory_order_release );
+    }
 
     /* initializes the memory */
     size_t *data = this->get_ptr( id );
-    data[0] = static_cast<size_t>( PlayerState::idle );
-    data[id + 1] = 0; // num_matches
+    data[0] = 0; // lock and version
+    data[1] = static_cast<size_t>( PlayerState::idle );
+    data[2] = 0; // num_matches
     for( size_t i = 0; i < this->max_matches; i++ ) {
-        data[id + i + 2] = 0;
+        data[i + 3] = 0;
     }
 
+    /* the player is visible to the other processes once initialized */
+    this->header->players.store( id, std::memory_order_release );
+    this->update_index( id );
+
     LOG_DBG << "added player " << id << std::endl;
 }
 
@@ -83,10 +188,8 @@ Player PlayersTable::get_player( player_t id ) {
         throw IPC::Error( "Invalid player id" );
     }
 
-    off_t offset = ( off_t )id;
-    off_t len = 1;
-    // TODO: change fd
-    return Player{ id, this->get_ptr( id ), Lock{ 1, offset, len, Lock::Mode::write } };
+    RWLock lock = this->lock( id, RWLock::Mode::write );
+    return Player{ this, id, this->get_ptr( id ) + 1, std::move( lock ) };
 }
 
 
@@ -101,10 +204,8 @@ PlayerRO PlayersTable::get_player_ro( player_t id ) {
         throw IPC::Error( "Invalid player id" );
     }
 
-    off_t offset = ( off_t )id;
-    off_t len = 1;
-    // TODO: change fd
-    return PlayerRO{ id, this->get_ptr( id ), Lock{ 1, offset, len, Lock::Mode::read } };
+    RWLock lock = this->lock( id, RWLock::Mode::read );
+    return PlayerRO{ this, id, this->get_ptr( id ) + 1, std::move( lock ) };
 }
 
 /**
@@ -113,18 +214,279 @@ PlayerRO PlayersTable::get_player_ro( player_t id ) {
  * \return Number of players.
  */
 size_t PlayersTable::size() {
-    return this->storage[0];
+    return this->header->players.load( std::memory_order_acquire );
 }
 
+/**
+ * Returns the record of a player (maps its segment if this process did not do it yet).
+ */
 size_t *PlayersTable::get_ptr( player_t id ) {
+    size_t index = ( id - 1 ) >> this->segment_bits;
+    size_t offset = ( id - 1 ) & ( ( static_cast<size_t>( 1 ) << this->segment_bits ) - 1 );
+
     try {
-        return this->storage.get_ptr( ( id - 1 ) * ( this->max_matches + 2 ) + 1 );
+        if( index >= this->segments.size() ) {
+            this->attach( index );
+        }
+        return this->segments[index].get_ptr( this->index_words + offset * this->record_size );
     } catch( const IPC::SharedMemError& e ) {
         LOG_DBG << e.what() << " id: " << id << std::endl;
         throw;
     }
 }
 
+/**
+ * Claims the players with a compare-and-swap of their states. If a player is not idle, the
+ * players already claimed are set back to idle.
+ *
+ * \param ids IDs of the players.
+ * \return \c true if all the players were claimed.
+ */
+bool PlayersTable::claim( std::initializer_list<player_t> ids ) {
+    size_t claimed = 0;
+    for( player_t id: ids ) {
+        size_t expected = static_cast<size_t>( PlayerState::idle );
+        std::atomic<uint32_t> *version = this->version_ptr( id );
+        _begin_write( version );
+        bool taken = this->state_ptr( id )->compare_exchange_strong( expected, static_cast<size_t>( PlayerState::playing ), std::memory_order_acq_rel );
+        _end_write( version );
+        if( !taken ) {
+            /* the index may still have the player if it was taken right now */
+            this->update_index( id );
+            break;
+        }
+        claimed++;
+    }
+
+    if( claimed == ids.size() ) {
+        for( player_t id: ids ) {
+            this->update_index( id );
+        }
+        return true;
+    }
+
+    /* gives back the players taken */
+    for( auto it = ids.begin(); claimed > 0; it++, claimed-- ) {
+        std::atomic<uint32_t> *version = this->version_ptr( *it );
+        _begin_write( version );
+        this->state_ptr( *it )->store( static_cast<size_t>( PlayerState::idle ), std::memory_order_release );
+        _end_write( version );
+    }
+    return false;
+}
+
+/**
+ * Seqlock read: the version is read before and after copying the record, and the copy is retried
+ * if a writer was in the middle of a change (odd version) or changed it meanwhile.
+ *
+ * \param id     ID of the player.
+ * \param player Where the copy is stored.
+ */
+void PlayersTable::snapshot( player_t id, PlayerSnapshot& player ) {
+    size_t *record = this->get_ptr( id );
+    std::atomic<uint32_t> *version = this->version_ptr( id );
+
+    player.id = id;
+    size_t spins = 0;
+    while( true ) {
+        uint32_t before = version->load( std::memory_order_acquire );
+        if( before & 1 ) {
+            _relax( spins );
+            continue;
+        }
+
+        player.state = static_cast<PlayerState>( this->state_ptr( id )->load( std::memory_order_relaxed ) );
+        size_t num_pairs = std::min( record[2], this->max_matches );
+        player.pairs.assign( &record[3], &record[3] + num_pairs );
+
+        std::atomic_thread_fence( std::memory_order_acquire );
+        if( version->load( std::memory_order_relaxed ) == before ) {
+            return;
+        }
+    }
+}
+
+void PlayersTable::snapshot( std::vector<PlayerSnapshot>& players ) {
+    players.resize( this->size() );
+    for( size_t i = 0; i < players.size(); i++ ) {
+        this->snapshot( i + 1, players[i] );
+    }
+}
+
+void PlayersTable::available_players( std::vector<player_t>& ids ) {
+    ids.clear();
+    this->collect_available( ids, 1, this->size() + 1, SIZE_MAX );
+}
+
+void PlayersTable::available_players( std::vector<player_t>& ids, player_t from, size_t max ) {
+    ids.clear();
+    from = std::max<player_t>( from, 1 );
+    this->collect_available( ids, from, this->size() + 1, max );
+    this->collect_available( ids, 1, from, max );
+}
+
+/**
+ * Walks the summary words of each segment and, for each bit set, the word of the bitmap. The
+ * summary bits of the words found empty are cleared.
+ *
+ * \param ids  Where the IDs are appended.
+ * \param from First player included.
+ * \param to   First player not included.
+ * \param max  Size of \a ids where it stops.
+ */
+void PlayersTable::collect_available( std::vector<player_t>& ids, player_t from, player_t to, size_t max ) {
+    size_t segments = this->header->segments.load( std::memory_order_acquire );
+    if( segments == 0 || from >= to ) {
+        return;
+    }
+    if( this->segments.size() < segments ) {
+        this->attach( segments - 1 );
+    }
+
+    for( size_t s = ( from - 1 ) >> this->segment_bits; s < segments && ids.size() < max; s++ ) {
+        auto summary = reinterpret_cast<std::atomic<uint64_t>*>( this->segments[s].get_ptr( 0 ) );
+        auto bitmap = summary + this->summary_words;
+
+        /* only the first segment starts after its first player */
+        size_t base = s << this->segment_bits;
+        size_t first = ( from - 1 > base ? from - 1 - base : 0 );
+
+        for( size_t i = first / 64 / 64; i < this->summary_words; i++ ) {
+            uint64_t words = summary[i].load();
+            if( i == first / 64 / 64 ) {
+                words &= ~static_cast<uint64_t>( 0 ) << ( ( first / 64 ) % 64 );
+            }
+
+            while( words != 0 ) {
+                size_t w = i * 64 + __builtin_ctzll( words );
+                uint64_t summary_bit = words & -words;
+                words &= words - 1;
+
+                uint64_t bits = bitmap[w].load();
+                if( bits == 0 ) {
+                    /* a player may have been set after reading the word: puts the bit back */
+                    summary[i].fetch_and( ~summary_bit );
+                    if( bitmap[w].load() != 0 ) {
+                        summary[i].fetch_or( summary_bit );
+                    }
+                    continue;
+                }
+                if( w == first / 64 ) {
+                    bits &= ~static_cast<uint64_t>( 0 ) << ( first % 64 );
+                }
+
+                while( bits != 0 ) {
+                    player_t id = base + w * 64 + __builtin_ctzll( bits ) + 1;
+                    if( id >= to || ids.size() >= max ) {
+                        return;
+                    }
+                    ids.push_back( id );
+                    bits &= bits - 1;
+                }
+            }
+        }
+    }
+}
+
+size_t PlayersTable::available() {
+    return this->header->available.load( std::memory_order_acquire );
+}
+
+size_t PlayersTable::exhausted() {
+    return this->header->exhausted.load( std::memory_order_acquire );
+}
+
+uint32_t PlayersTable::changes() {
+    return this->header->changes.load( std::memory_order_acquire );
+}
+
+void PlayersTable::wait_changes( uint32_t seen, std::chrono::milliseconds timeout ) {
+    struct timespec ts;
+    ts.tv_sec = timeout.count() / 1000;
+    ts.tv_nsec = ( timeout.count() % 1000 ) * 1000000;
+
+    /* counted before sleeping, so a change after \a seen was read either wakes it up or is seen */
+    this->header->changes_waiting.fetch_add( 1 );
+    IPC::futex_wait( &this->header->changes, seen, &ts );
+    this->header->changes_waiting.fetch_sub( 1 );
+}
+
+bool PlayersTable::is_available( player_t id ) {
+    size_t *data = this->get_ptr( id );
+    return ( this->state_ptr( id )->load( std::memory_order_acquire ) == static_cast<size_t>( PlayerState::idle ) &&
+             data[2] < this->max_matches );
+}
+
+/**
+ * Sets the bit of the player in the index from its state and matches. The bit is changed without
+ * locks, so the state is checked again afterwards: if another process changed it meanwhile, the
+ * bit is set again (the last one to change the bit always sees the last state).
+ */
+void PlayersTable::update_index( player_t id ) {
+    size_t index = ( id - 1 ) >> this->segment_bits;
+    size_t offset = ( id - 1 ) & ( ( static_cast<size_t>( 1 ) << this->segment_bits ) - 1 );
+    if( index >= this->segments.size() ) {
+        this->attach( index );
+    }
+
+    auto summary = reinterpret_cast<std::atomic<uint64_t>*>( this->segments[index].get_ptr( 0 ) );
+    std::atomic<uint64_t>& word = summary[this->summary_words + offset / 64];
+    uint64_t bit = static_cast<uint64_t>( 1 ) << ( offset % 64 );
+
+    bool available;
+    do {
+        available = this->is_available( id );
+        if( available ) {
+            if( !( word.fetch_or( bit ) & bit ) ) {
+                summary[offset / 64 / 64].fetch_or( static_cast<uint64_t>( 1 ) << ( ( offset / 64 ) % 64 ) );
+                this->header->available.fetch_add( 1 );
+                this->header->changes.fetch_add( 1 );
+                if( this->header->changes_waiting.load() > 0 ) {
+                    IPC::futex_wake( &this->header->changes, INT32_MAX );
+                }
+            }
+        } else if( word.fetch_and( ~bit ) & bit ) {
+            this->header->available.fetch_sub( 1 );
+        }
+    } while( available != this->is_available( id ) );
+}
+
+std::atomic<size_t> *PlayersTable::state_ptr( player_t id ) {
+    return reinterpret_cast<std::atomic<size_t>*>( this->get_ptr( id ) + 1 );
+}
+
+/**
+ * The version is the upper half of the lock word.
+ */
+std::atomic<uint32_t> *PlayersTable::version_ptr( player_t id ) {
+    return reinterpret_cast<std::atomic<uint32_t>*>( this->get_ptr( id ) ) + 1;
+}
+
+/**
+ * Takes the lock of a player (the first word of its record).
+ */
+RWLock PlayersTable::lock( player_t id, RWLock::Mode mode ) {
+    return RWLock{ reinterpret_cast<std::atomic<uint32_t>*>( this->get_ptr( id ) ), mode };
+}
+
+/**
+ * Maps all the segments up to \a index.
+ */
+void PlayersTable::attach( size_t index ) {
+    if( index >= this->header->segments.load( std::memory_order_acquire ) ) {
+        throw IPC::SharedMemError( "Out of bounds: segment " + std::to_string( index ) );
+    }
+
+    while( this->segments.size() <= index ) {
+        std::string name = PlayersTable::segment_name( this->name, this->segments.size() );
+        this->segments.push_back( MappedMem<size_t>{ name, _segment_words( this->segment_bits, this->record_size ), TABLE_OPTIONS } );
+    }
+}
+
+std::string PlayersTable::segment_name( const std::string& name, size_t index ) {
+    return name + "_" + std::to_string( index );
+}
+
 /**
  * Gets an iterator for the table.
  * 
@@ -169,25 +531,39 @@ bool PlayersTable::iterator::operator!=( PlayersTable::iterator& other ) {
  */
 
 
+bool PlayerSnapshot::has_played_with( player_t other ) const {
+    return PairSearch::contains( this->pairs.data(), this->pairs.size(), other );
+}
+
+
 bool Player::has_played_with( const Player& other ) const {
-    for( size_t i = 0; i < *this->num_pairs; i++ ) {
-        if( this->pairs[i] == other.id ) {
-            return true;
-        }
-    }
-    return false;
+    return PairSearch::contains( this->pairs, *this->num_pairs, other.id );
 }
 
 size_t Player::num_matches() const {
     return *this->num_pairs;
 }
 
+/**
+ * The writers hold the lock of the player, so they only wait for the claims (see \c _begin_write).
+ */
+void Player::begin_write() {
+    _begin_write( this->version );
+}
+
+void Player::end_write() {
+    _end_write( this->version );
+}
+
 void Player::set_state( PlayerState new_state ) {
-    *this->state = static_cast<size_t>( new_state );
+    this->begin_write();
+    this->state->store( static_cast<size_t>( new_state ), std::memory_order_release );
+    this->end_write();
+    this->table->update_index( this->id );
 }
 
 PlayerState Player::get_state() {
-    return static_cast<PlayerState>( *this->state );
+    return static_cast<PlayerState>( this->state->load( std::memory_order_acquire ) );
 }
 
 void Player::set_pair( Player& other ) {
@@ -195,9 +571,22 @@ void Player::set_pair( Player& other ) {
         throw IPC::Error( "Pair repeated" );
     }
 
+    this->begin_write();
+    other.begin_write();
+
     this->pairs[*this->num_pairs] = other.id;
     other.pairs[*other.num_pairs] = this->id;
 
     *this->num_pairs += 1;
     *other.num_pairs += 1;
+
+    this->end_write();
+    other.end_write();
+
+    for( Player* p: { this, &other } ) {
+        if( *p->num_pairs == this->table->max_matches ) {
+            this->table->header->exhausted.fetch_add( 1 );
+        }
+        this->table->update_index( p->id );
+    }
 }
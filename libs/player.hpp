@@ -2,9 +2,13 @@
 #define PLAYER_HPP
 
 /* include area */
-#include "lock.hpp"
 #include "log.hpp"
-#include "shared_mem.hpp"
+#include "mapped_mem.hpp"
+#include "rw_lock.hpp"
+#include <atomic>
+#include <chrono>
+#include <initializer_list>
+#include <stdint.h>
 #include <vector>
 #include <set>
 #include <string>
@@ -34,12 +38,15 @@ class Player {
 
 public:
     Player( Player&& other ) : lock(std::move(other.lock)) {
+        this->table = other.table;
         this->id = other.id;
+        this->version = other.version;
         this->state = other.state;
         this->pairs = other.pairs;
         this->num_pairs = other.num_pairs;
         
         other.id = 0;
+        other.version = nullptr;
         other.state = nullptr;
         other.pairs = nullptr;
         other.num_pairs = nullptr;
@@ -67,15 +74,28 @@ public:
     bool operator==( Player& other ) { return this->id == other.id; }
     
 protected:
-    Player( player_t id, size_t *data, IPC::Lock lock ) : lock(std::move(lock)) {
+    /** Table of the player (keeps its index up to date). */
+    PlayersTable* table{nullptr};
+
+    Player( PlayersTable* table, player_t id, size_t *data, IPC::RWLock lock ) : lock(std::move(lock)) {
+        this->table = table;
         this->id = id;
-        this->state = &data[0];
+        /* the version is the upper half of the lock word */
+        this->version = reinterpret_cast<std::atomic<uint32_t>*>( &data[-1] ) + 1;
+        this->state = reinterpret_cast<std::atomic<size_t>*>( &data[0] );
         this->num_pairs = &data[1];
         this->pairs = &data[2];
     }
     
-    /** The current player's state. */
-    size_t *state{nullptr};
+    /** Marks the start and the end of a change, for the readers of snapshots. */
+    void begin_write();
+    void end_write();
+
+    /** Version of the record (odd while it's being changed, see \c PlayersTable::snapshot). */
+    std::atomic<uint32_t> *version{nullptr};
+
+    /** The current player's state (changed atomically, see \c PlayersTable::claim). */
+    std::atomic<size_t> *state{nullptr};
 
     /** Array with the pairs that this player had. */
     player_t *pairs{nullptr};
@@ -83,8 +103,21 @@ protected:
     /** Number of pairs this player had. */
     size_t *num_pairs{nullptr};
 
-    /** The memory lock. */
-    IPC::Lock lock;
+    /** The lock of the player (kept in its record). */
+    IPC::RWLock lock;
+};
+
+
+/**
+ * A copy of a player taken without locks (see \c PlayersTable::snapshot).
+ */
+struct PlayerSnapshot {
+    player_t id{0};
+    PlayerState state{PlayerState::unavailable};
+    std::vector<player_t> pairs;
+
+    size_t num_matches() const { return this->pairs.size(); }
+    bool has_played_with( player_t other ) const;
 };
 
 
@@ -117,7 +150,7 @@ public:
     bool operator==( PlayerRO& other ) { return this->id == other.id; }
     
 protected:
-    PlayerRO( player_t id, size_t *data, IPC::Lock&& lock ) : id(id), player(id, data, std::move(lock)) {} 
+    PlayerRO( PlayersTable* table, player_t id, size_t *data, IPC::RWLock&& lock ) : id(id), player(table, id, data, std::move(lock)) {}
     Player player;
 
 };
@@ -125,8 +158,16 @@ protected:
 
 /**
  * The table with the information about the players.
+ * The players are kept in segments of shared memory that are created as players are added (by a
+ * single process), so the table has no fixed capacity. Each process maps the segments the first
+ * time it accesses one of their players.
+ * Each segment starts with an index of the available players (idle and with matches left): a
+ * bitmap with a bit per player and a summary with a bit per word of the bitmap, so the available
+ * players are found without going through the records of the others.
  */
 class PlayersTable {
+    friend class Player;
+
 public:
 
     /**
@@ -147,10 +188,10 @@ public:
         PlayersTable* table{nullptr};
     };
 
-    static void Create( IPC::Key key, size_t max_players, size_t max_matches );
+    static void Create( IPC::Key key, size_t max_matches );
     static void Destroy( IPC::Key key );
     
-    PlayersTable( IPC::Key key, size_t max_players, size_t max_matches );
+    PlayersTable( IPC::Key key );
     ~PlayersTable();
     
     /* query */
@@ -158,18 +199,96 @@ public:
     Player get_player( player_t id );
     PlayerRO get_player_ro( player_t id );
     size_t size();
+
+    /**
+     * Moves the players from idle to playing, only if all of them are idle (otherwise none is
+     * changed). Does not take the locks of the players, but bumps their versions.
+     */
+    bool claim( std::initializer_list<player_t> ids );
+
+    /**
+     * Copies a player without taking its lock: the copy is retried if the player was changed
+     * while it was copied (its version changed).
+     */
+    void snapshot( player_t id, PlayerSnapshot& player );
+
+    /** Copies all the players (each one is consistent, not the table as a whole). */
+    void snapshot( std::vector<PlayerSnapshot>& players );
+
+    /** Gets the IDs of the available players (idle and with matches left) from the index. */
+    void available_players( std::vector<player_t>& ids );
+
+    /**
+     * Gets at most \a max available players, starting at the player \a from and going on from
+     * the first player after the last one.
+     */
+    void available_players( std::vector<player_t>& ids, player_t from, size_t max );
+
+    /** Number of available players. */
+    size_t available();
+
+    /** Number of players that have played all their matches. */
+    size_t exhausted();
+
+    /** Counter bumped each time a player becomes available. */
+    uint32_t changes();
+
+    /**
+     * Blocks until a player becomes available after \a seen was read from \c changes (or until
+     * the timeout expires).
+     */
+    void wait_changes( uint32_t seen, std::chrono::milliseconds timeout );
     
     /* iteration */
     iterator begin();
     iterator end();
     
-    size_t max_players{0};
     size_t max_matches{0};
 
 private:
 
-    IPC::SharedMem<size_t> storage;
+    /** Kept in its own segment, shared by all the processes. */
+    struct Header {
+        /** Number of players added. */
+        std::atomic<size_t> players;
+        /** Number of segments created. */
+        std::atomic<size_t> segments;
+        size_t max_matches;
+        /** Each segment has 2^segment_bits players. */
+        size_t segment_bits;
+        /** Number of players in the index. */
+        std::atomic<size_t> available;
+        /** Number of players with no matches left. */
+        std::atomic<size_t> exhausted;
+        /** Bumped when a player becomes available (the producer waits on it with a futex). */
+        std::atomic<uint32_t> changes;
+        /** Processes waiting on \c changes (it's only woken up if there's someone waiting). */
+        std::atomic<uint32_t> changes_waiting;
+    };
+
+    static std::string segment_name( const std::string& name, size_t index );
+
     size_t *get_ptr( player_t id );
+    std::atomic<size_t> *state_ptr( player_t id );
+    std::atomic<uint32_t> *version_ptr( player_t id );
+    bool is_available( player_t id );
+    void collect_available( std::vector<player_t>& ids, player_t from, player_t to, size_t max );
+    void update_index( player_t id );
+    IPC::RWLock lock( player_t id, IPC::RWLock::Mode mode );
+    void attach( size_t index );
+
+    /** Name of the header segment (the segments take their names from it). */
+    std::string name;
+    IPC::MappedMem<Header> header;
+
+    /** Segments mapped by this process (mapped with huge pages and prefaulted, so the first
+     *  scans do not fault). */
+    std::vector<IPC::MappedMem<size_t>> segments;
+    size_t segment_bits{0};
+    size_t record_size{0};
+    /** Words of the summary and of the bitmap at the beginning of each segment. */
+    size_t summary_words{0};
+    size_t index_words{0};
 };
 
 
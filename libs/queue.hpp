@@ -4,11 +4,19 @@
 /* include area */
 #include "ipc.hpp"
 #include "log.hpp"
+#include "queue_stats.hpp"
+#include "mapped_mem.hpp"
 #include <errno.h>
+#include <algorithm>
+#include <chrono>
 #include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <stdint.h>
 #include <string>
 #include <string.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
 
@@ -39,6 +47,8 @@ namespace IPC {
 
     /**
      * An inter-process queue for a specific data type T.
+     * Each element travels with the timestamp of its insertion, used to keep the statistics of the
+     * queue (see \c QueueStats).
      */
     template<class T> class Queue {
         
@@ -50,16 +60,50 @@ namespace IPC {
         
         Queue( const std::string& filename, QueueMode mode );
         Queue( const std::string& filename, QueueMode mode, bool uninterrupted );
+        Queue( Queue&& other );
         Queue& operator=( const Queue& other );
         ~Queue();
         
         void insert( T elem );
         T remove();
+
+        /** Batched versions: return the number of elements transferred. */
+        size_t insert_many( const T* elems, size_t n );
+        size_t remove_many( T* elems, size_t n );
+
+        /** Non-blocking and timed versions: return \c false if no element was read. */
+        bool try_remove( T& elem );
+        bool remove_for( T& elem, std::chrono::milliseconds timeout );
+
+        /** Returns \c true once a read found that all the writers left. */
+        bool eof() const { return this->closed; }
+
+        /** Returns the number of elements buffered in the queue. */
+        size_t size();
+
+        /** Returns the statistics of the queue (shared by all the processes). */
+        IPC::QueueStats& stats() { return *this->counters; }
+
+        /** Returns the file descriptor (to wait for the queue along with other sources). */
+        int get_fd() const { return this->fd; }
         
     private:
+        /** Size of an element and its timestamp in the FIFO. */
+        static constexpr size_t FRAME_SIZE = sizeof( uint64_t ) + sizeof( T );
+
+        /** Maximum number of elements moved per syscall. */
+        static constexpr size_t MAX_FRAMES = 256;
+
+        static void frames_iov( struct iovec* iov, uint64_t* stamps, T* elems, size_t n );
+        static ssize_t readv_at( int fd, struct iovec* iov, int iovcnt, size_t offset );
+        void set_nonblocking( bool nonblocking );
+
         std::string filename;
+        IPC::MappedMem<IPC::QueueStats> counters;
         int fd { -1 };
         bool uninterrupted;
+        bool nonblocking{ false };
+        bool closed{ false };
     };
     
 }
@@ -68,19 +112,35 @@ namespace IPC {
  * Implementation
  */
 
+template <class T> constexpr size_t IPC::Queue<T>::FRAME_SIZE;
+template <class T> constexpr size_t IPC::Queue<T>::MAX_FRAMES;
+
 
 /**
  * Creates the Queue so it's available to the other processes.
+ * If the statistics can't be created, the FIFO is removed (so the next run can create it again).
  */
 template <class T> void IPC::Queue<T>::Create( const std::string& filename ) {
     if( mknod( static_cast<const char*>( filename.c_str() ), S_IFIFO | 0644, 0 ) )
         throw IPC::QueueError( strerror( errno ) );
+
+    try {
+        IPC::MappedMem<IPC::QueueStats>::Create( IPC::QueueStats::Name( filename ), 1, IPC::MapOptions::none );
+    } catch( const IPC::Error& e ) {
+        unlink( static_cast<const char*>( filename.c_str() ) );
+        throw;
+    }
 }
 
 /**
  * Destroys the Queue (no other processes will be able to connect again).
  */
 template <class T> void IPC::Queue<T>::Destroy( const std::string& filename ) {
+    try {
+        IPC::MappedMem<IPC::QueueStats>::Destroy( IPC::QueueStats::Name( filename ) );
+    } catch( const IPC::Error& e ) {
+        LOG_DBG << e.what() << std::endl;
+    }
     unlink( static_cast<const char*>( filename.c_str() ) );
     LOG_DBG << "destroy" << std::endl;
 }
@@ -92,7 +152,8 @@ template <class T> void IPC::Queue<T>::Destroy( const std::string& filename ) {
 template <class T> IPC::Queue<T>::Queue( const std::string& filename, IPC::QueueMode mode ) : Queue(filename, mode, false) {
 }
 
-template <typename T> IPC::Queue<T>::Queue( const std::string& filename, IPC::QueueMode mode, bool uninterrupted ) : filename(filename) {
+template <typename T> IPC::Queue<T>::Queue( const std::string& filename, IPC::QueueMode mode, bool uninterrupted ) : filename(filename),
+                                                                                                                   counters(IPC::QueueStats::Name( filename ), 1, IPC::MapOptions::none) {
     this->fd = open( this->filename.c_str(), static_cast<int>( mode ) );
     if( this->fd == -1 )
         throw IPC::QueueError( strerror( errno ) );
@@ -100,6 +161,17 @@ template <typename T> IPC::Queue<T>::Queue( const std::string& filename, IPC::Qu
     this->uninterrupted = uninterrupted;
 }
 
+/**
+ * Move constructor.
+ */
+template <class T> IPC::Queue<T>::Queue( Queue&& other ) : filename(other.filename),
+                                                          counters(std::move( other.counters )),
+                                                          uninterrupted(other.uninterrupted),
+                                                          nonblocking(other.nonblocking),
+                                                          closed(other.closed) {
+    std::swap( this->fd, other.fd );
+}
+
 /**
  * Queue destructor implementation.
  */
@@ -116,43 +188,239 @@ template <class T> IPC::Queue<T>::~Queue() {
  * \param elem Element to insert.
  */
 template <class T> void IPC::Queue<T>::insert( T elem ) {
-    do {
-        if( write( this->fd, &elem, sizeof( T ) ) == -1 ) {
+    this->insert_many( &elem, 1 );
+}
+
+/**
+ * Gets an element from the Queue.
+ *
+ * \return The element removed.
+ */
+template <class T> T IPC::Queue<T>::remove() {
+    T rv;
+    this->remove_many( &rv, 1 );
+    return rv;
+}
+
+/**
+ * Inserts many elements into the Queue.
+ * Elements are written in chunks of at most \c PIPE_BUF bytes, so each write is atomic and no
+ * element gets mixed with the ones of other writers.
+ *
+ * \param elems Elements to insert.
+ * \param n     Number of elements.
+ * \return The number of elements inserted (less than \a n only if interrupted).
+ */
+template <class T> size_t IPC::Queue<T>::insert_many( const T* elems, size_t n ) {
+    const size_t chunk = std::max<size_t>( 1, std::min( PIPE_BUF / FRAME_SIZE, MAX_FRAMES ) );
+
+    /* all the elements share the same timestamp */
+    uint64_t stamp = IPC::QueueStats::now();
+    struct iovec iov[2 * MAX_FRAMES];
+    size_t inserted = 0;
+
+    while( inserted < n ) {
+        size_t count = std::min( chunk, n - inserted );
+        for( size_t i = 0; i < count; i++ ) {
+            iov[2 * i] = { &stamp, sizeof( stamp ) };
+            iov[2 * i + 1] = { const_cast<T *>( elems + inserted + i ), sizeof( T ) };
+        }
+
+        /* counted before writing so the readers never see a negative depth */
+        this->counters->on_insert( count );
+        if( writev( this->fd, iov, 2 * count ) == -1 ) {
+            this->counters->on_insert_failed( count );
             if( errno == EINTR && this->uninterrupted ) {
                 /* retries */
                 continue;
             }
+            if( errno == EINTR && inserted > 0 ) {
+                break;
+            }
             throw IPC::QueueError( strerror( errno ) );
         }
-    } while( errno == EINTR );
+        inserted += count;
+    }
+
+    return inserted;
 }
 
 /**
- * Gets an element from the Queue.
+ * Gets up to \a n elements from the Queue.
+ * Blocks until at least one element is available and returns everything that is already
+ * buffered (up to \a n), so a backlog can be drained with a single call.
  *
- * \param elem Element to insert.
+ * \param elems Buffer where the elements are stored.
+ * \param n     Maximum number of elements to read.
+ * \return The number of elements read (at least 1).
  */
-template <class T> T IPC::Queue<T>::remove() {
-    T rv;
+template <class T> size_t IPC::Queue<T>::remove_many( T* elems, size_t n ) {
+    this->set_nonblocking( false );
+
+    uint64_t stamps[MAX_FRAMES];
+    struct iovec iov[2 * MAX_FRAMES];
+    size_t count = std::min( n, MAX_FRAMES );
+    frames_iov( iov, stamps, elems, count );
 
-    do {
-        int bytes_read = read( this->fd, &rv, sizeof( T ) );
+    size_t bytes = 0;
+    while( bytes == 0 || bytes % FRAME_SIZE != 0 ) {
+        /* after reading part of an element, only the rest of it is read */
+        size_t frames = ( bytes == 0 ? count : bytes / FRAME_SIZE + 1 );
+
+        ssize_t bytes_read = readv_at( this->fd, iov, 2 * frames, bytes );
         if( bytes_read == 0 ) {
+            this->closed = true;
             throw IPC::QueueEOF();
         }
-    
-        if( bytes_read != sizeof( T ) ) {
+
+        if( bytes_read < 0 ) {
             if( errno == EINTR && this->uninterrupted ) {
                 /* retries */
                 continue;
             }
             throw IPC::QueueError( strerror( errno ) );
         }
-    } while( errno == EINTR );
+        bytes += bytes_read;
+    }
 
-    /* TODO: use move semantics */
+    size_t removed = bytes / FRAME_SIZE;
+    this->counters->on_remove( stamps, removed, IPC::QueueStats::now() );
+    return removed;
+}
+
+/**
+ * Gets an element from the Queue only if there's one available.
+ *
+ * \param elem Where the element is stored.
+ * \return \c true if an element was read.
+ */
+template <class T> bool IPC::Queue<T>::try_remove( T& elem ) {
+    return this->remove_for( elem, std::chrono::milliseconds( 0 ) );
+}
+
+/**
+ * Gets an element from the Queue waiting at most \a timeout for it.
+ * Instead of throwing, returns \c false on timeout, when interrupted by a signal (unless the
+ * queue is uninterrupted) or when the queue reached the end (see \c eof).
+ *
+ * \param elem    Where the element is stored.
+ * \param timeout Maximum time to wait.
+ * \return \c true if an element was read.
+ */
+template <class T> bool IPC::Queue<T>::remove_for( T& elem, std::chrono::milliseconds timeout ) {
+    using std::chrono::steady_clock;
+    using std::chrono::milliseconds;
+
+    this->set_nonblocking( true );
+
+    auto deadline = steady_clock::now() + timeout;
+    uint64_t stamp;
+    struct iovec iov[2];
+    frames_iov( iov, &stamp, &elem, 1 );
+    size_t bytes = 0;
+
+    while( bytes < FRAME_SIZE ) {
+        /* reads first, so no extra syscall is made if there's data available */
+        ssize_t bytes_read = readv_at( this->fd, iov, 2, bytes );
+        if( bytes_read > 0 ) {
+            bytes += bytes_read;
+            continue;
+        }
+
+        if( bytes_read == 0 ) {
+            this->closed = true;
+            return false;
+        }
+
+        if( errno != EAGAIN && errno != EINTR ) {
+            throw IPC::QueueError( strerror( errno ) );
+        }
+
+        /* once part of an element was read, waits for the rest of it with no timeout */
+        int wait_ms = -1;
+        if( bytes == 0 ) {
+            if( errno == EINTR && !this->uninterrupted ) {
+                return false;
+            }
+
+            wait_ms = std::chrono::duration_cast<milliseconds>( deadline - steady_clock::now() ).count();
+            if( wait_ms <= 0 ) {
+                return false;
+            }
+        }
+
+        struct pollfd pfd = { this->fd, POLLIN, 0 };
+        if( poll( &pfd, 1, wait_ms ) < 0 ) {
+            if( errno != EINTR ) {
+                throw IPC::QueueError( strerror( errno ) );
+            }
+            if( bytes == 0 && !this->uninterrupted ) {
+                return false;
+            }
+        }
+    }
+
+    this->counters->on_remove( &stamp, 1, IPC::QueueStats::now() );
+    return true;
+}
+
+/**
+ * Returns the number of elements written to the queue that were not read yet.
+ * Taken from the statistics, so no syscall is needed.
+ */
+template <class T> size_t IPC::Queue<T>::size() {
+    return this->counters->depth();
+}
+
+/**
+ * Fills \a iov so each element is read/written along with its timestamp.
+ */
+template <class T> void IPC::Queue<T>::frames_iov( struct iovec* iov, uint64_t* stamps, T* elems, size_t n ) {
+    for( size_t i = 0; i < n; i++ ) {
+        iov[2 * i] = { &stamps[i], sizeof( uint64_t ) };
+        iov[2 * i + 1] = { &elems[i], sizeof( T ) };
+    }
+}
+
+/**
+ * Same as \c readv but skips the first \a offset bytes of the buffers.
+ */
+template <class T> ssize_t IPC::Queue<T>::readv_at( int fd, struct iovec* iov, int iovcnt, size_t offset ) {
+    int first = 0;
+    while( first < iovcnt && offset >= iov[first].iov_len ) {
+        offset -= iov[first].iov_len;
+        first++;
+    }
+
+    /* adjusts the first buffer and restores it after reading */
+    struct iovec original = iov[first];
+    iov[first].iov_base = static_cast<char *>( iov[first].iov_base ) + offset;
+    iov[first].iov_len -= offset;
+
+    ssize_t rv = readv( fd, iov + first, iovcnt - first );
+
+    iov[first] = original;
     return rv;
 }
 
+/**
+ * Changes the blocking mode of the file descriptor (only when it differs from the current one).
+ */
+template <class T> void IPC::Queue<T>::set_nonblocking( bool nonblocking ) {
+    if( this->nonblocking == nonblocking ) {
+        return;
+    }
+
+    int flags = fcntl( this->fd, F_GETFL );
+    if( flags < 0 )
+        throw IPC::QueueError( strerror( errno ) );
+
+    flags = ( nonblocking ? flags | O_NONBLOCK : flags & ~O_NONBLOCK );
+    if( fcntl( this->fd, F_SETFL, flags ) < 0 )
+        throw IPC::QueueError( strerror( errno ) );
+
+    this->nonblocking = nonblocking;
+}
+
 
 #endif
@@ -0,0 +1,139 @@
+/**
+ * Counters of an IPC queue kept in shared memory.
+ */
+
+#ifndef QUEUE_STATS_HPP
+#define QUEUE_STATS_HPP
+
+/* include area */
+#include "ipc.hpp"
+#include <algorithm>
+#include <atomic>
+#include <iostream>
+#include <stdint.h>
+#include <string>
+#include <time.h>
+
+
+namespace IPC {
+
+    /**
+     * Statistics of a queue shared by all the processes that use it.
+     * Every field is updated atomically, so any process can read them at any time.
+     */
+    struct QueueStats {
+        /** Number of buckets of the latency histogram (bucket i counts latencies in [2^i, 2^(i+1)) ns). */
+        static const size_t LATENCY_BUCKETS = 40;
+
+        /**
+         * Returns the name of the shared memory object of the stats of the queue with the given
+         * filename (the filename itself, so queues never share their stats).
+         */
+        static std::string Name( const std::string& filename );
+
+        /** Returns the current timestamp in nanoseconds (the same clock in all the processes). */
+        static uint64_t now();
+
+        /** Registers elements inserted/removed. */
+        void on_insert( uint64_t n );
+        void on_insert_failed( uint64_t n ) { this->enqueued.fetch_sub( n, std::memory_order_relaxed ); }
+        void on_remove( const uint64_t* timestamps, size_t n, uint64_t now );
+
+        /** Elements inserted but not removed yet. */
+        uint64_t depth() const;
+
+        /** Upper bound of the latency (in ns) under which are the given fraction of the elements. */
+        uint64_t latency_percentile( double fraction ) const;
+
+        std::atomic<uint64_t> enqueued;
+        std::atomic<uint64_t> dequeued;
+        std::atomic<uint64_t> high_water;
+        std::atomic<uint64_t> latency[LATENCY_BUCKETS];
+
+        friend std::ostream& operator<<( std::ostream& os, const QueueStats& stats ) {
+            return os << "enqueued=" << stats.enqueued.load()
+                      << " dequeued=" << stats.dequeued.load()
+                      << " depth=" << stats.depth()
+                      << " high_water=" << stats.high_water.load()
+                      << " p50<" << stats.latency_percentile( 0.5 ) / 1000 << "us"
+                      << " p99<" << stats.latency_percentile( 0.99 ) / 1000 << "us";
+        }
+    };
+}
+
+
+/**
+ * Implementation
+ */
+
+
+inline std::string IPC::QueueStats::Name( const std::string& filename ) {
+    std::string name = "/cv_q" + filename;
+    std::replace( name.begin() + 1, name.end(), '/', '_' );
+    return name;
+}
+
+inline uint64_t IPC::QueueStats::now() {
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return static_cast<uint64_t>( ts.tv_sec ) * 1000000000 + ts.tv_nsec;
+}
+
+/**
+ * Counts inserted elements (must be called before writing them, so the depth never goes below 0).
+ *
+ * \param n Number of elements.
+ */
+inline void IPC::QueueStats::on_insert( uint64_t n ) {
+    uint64_t depth = this->enqueued.fetch_add( n, std::memory_order_relaxed ) + n - this->dequeued.load( std::memory_order_relaxed );
+
+    uint64_t high_water = this->high_water.load( std::memory_order_relaxed );
+    while( depth > high_water && !this->high_water.compare_exchange_weak( high_water, depth, std::memory_order_relaxed ) ) {
+    }
+}
+
+/**
+ * Counts removed elements.
+ *
+ * \param timestamps When each element was inserted.
+ * \param n          Number of elements.
+ * \param now        Current timestamp.
+ */
+inline void IPC::QueueStats::on_remove( const uint64_t* timestamps, size_t n, uint64_t now ) {
+    this->dequeued.fetch_add( n, std::memory_order_relaxed );
+
+    for( size_t i = 0; i < n; i++ ) {
+        /* the bucket is the position of the most significant bit */
+        uint64_t elapsed = ( now > timestamps[i] ? now - timestamps[i] : 0 );
+        size_t bucket = ( elapsed < 2 ? 0 : 63 - __builtin_clzll( elapsed ) );
+        if( bucket >= LATENCY_BUCKETS ) {
+            bucket = LATENCY_BUCKETS - 1;
+        }
+        this->latency[bucket].fetch_add( 1, std::memory_order_relaxed );
+    }
+}
+
+inline uint64_t IPC::QueueStats::depth() const {
+    uint64_t dequeued = this->dequeued.load( std::memory_order_relaxed );
+    uint64_t enqueued = this->enqueued.load( std::memory_order_relaxed );
+    return ( enqueued > dequeued ? enqueued - dequeued : 0 );
+}
+
+inline uint64_t IPC::QueueStats::latency_percentile( double fraction ) const {
+    uint64_t total = 0;
+    for( size_t i = 0; i < LATENCY_BUCKETS; i++ ) {
+        total += this->latency[i].load( std::memory_order_relaxed );
+    }
+
+    uint64_t count = 0;
+    for( size_t i = 0; i < LATENCY_BUCKETS; i++ ) {
+        count += this->latency[i].load( std::memory_order_relaxed );
+        if( count > 0 && count >= fraction * total ) {
+            return static_cast<uint64_t>( 1 ) << ( i + 1 );
+        }
+    }
+    return 0;
+}
+
+
+#endif
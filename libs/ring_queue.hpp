@@ -0,0 +1,492 @@
+#ifndef RING_QUEUE_HPP
+#define RING_QUEUE_HPP
+
+/* include area */
+#include "futex.hpp"
+#include "ipc.hpp"
+#include "log.hpp"
+#include "mapped_mem.hpp"
+#include "queue.hpp"
+#include "queue_stats.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <errno.h>
+#include <new>
+#include <stdint.h>
+#include <string>
+#include <string.h>
+#include <time.h>
+#include <type_traits>
+#include <unistd.h>
+
+
+namespace IPC {
+
+    /**
+     * An inter-process queue for a specific data type T kept in a bounded ring in shared memory.
+     * Has the same interface as \c IPC::Queue (and is named after a filename the same way), but
+     * elements are copied into the ring without syscalls: processes only block (with a futex)
+     * when the ring is full or empty. Any number of processes can insert and remove concurrently.
+     * Unlike a FIFO, the ring can't tell if the readers left, so a writer blocks while it's full.
+     */
+    template<class T> class RingQueue {
+        static_assert( std::is_trivially_copyable<T>::value, "elements are copied between processes" );
+
+    public:
+
+        /** Creates/destroys a RingQueue that will be accessible from other modules. */
+        static void Create( const std::string& filename, size_t capacity );
+        static void Destroy( const std::string& filename );
+
+        /** Name of the shared memory object of the ring of the given filename. */
+        static std::string Name( const std::string& filename );
+
+        RingQueue( const std::string& filename, QueueMode mode );
+        RingQueue( const std::string& filename, QueueMode mode, bool uninterrupted );
+        RingQueue( RingQueue&& other );
+        RingQueue( const RingQueue& other ) = delete;
+        RingQueue& operator=( const RingQueue& other ) = delete;
+        ~RingQueue();
+
+        void insert( T elem );
+        T remove();
+
+        /** Batched versions: return the number of elements transferred. */
+        size_t insert_many( const T* elems, size_t n );
+        size_t remove_many( T* elems, size_t n );
+
+        /** Non-blocking and timed versions: return \c false if no element was read. */
+        bool try_remove( T& elem );
+        bool remove_for( T& elem, std::chrono::milliseconds timeout );
+
+        /** Returns \c true once a read found that all the writers left. */
+        bool eof() const { return this->closed; }
+
+        /** Returns the number of elements buffered in the queue. */
+        size_t size() { return this->header->stats.depth(); }
+
+        /** Returns the statistics of the queue (shared by all the processes). */
+        IPC::QueueStats& stats() { return this->header->stats; }
+
+    private:
+        /** Maximum number of elements moved by a single \c remove_many. */
+        static constexpr size_t MAX_BATCH = 256;
+
+        /** A position of the ring (the sequence tells if it's ready to be written or read). */
+        struct Slot {
+            std::atomic<size_t> seq;
+            uint64_t stamp;
+            T elem;
+        };
+
+        /** Ring state, placed at the beginning of the shared memory (followed by the slots). */
+        struct Header {
+            size_t mask;
+
+            /* positions where the next element is inserted/removed */
+            alignas( 64 ) std::atomic<size_t> head;
+            alignas( 64 ) std::atomic<size_t> tail;
+
+            /* futex words bumped when the ring stops being empty/full */
+            alignas( 64 ) std::atomic<uint32_t> not_empty;
+            std::atomic<uint32_t> readers_waiting;
+            alignas( 64 ) std::atomic<uint32_t> not_full;
+            std::atomic<uint32_t> writers_waiting;
+
+            /* writers connected (used to signal EOF to the readers) */
+            std::atomic<uint32_t> writers;
+            std::atomic<uint32_t> writers_seen;
+
+            alignas( 64 ) IPC::QueueStats stats;
+        };
+
+        /** Size of the header rounded so the slots are aligned. */
+        static constexpr size_t HEADER_SIZE = ( sizeof( Header ) + alignof( Slot ) - 1 ) / alignof( Slot ) * alignof( Slot );
+
+        bool push( const T& elem, uint64_t stamp );
+        bool pop( T& elem, uint64_t& stamp );
+        size_t pop_many( T* elems, uint64_t* stamps, size_t n );
+        size_t wait_remove( T* elems, size_t n, const std::chrono::steady_clock::time_point* deadline );
+        bool wait( std::atomic<uint32_t>& word, uint32_t value, std::atomic<uint32_t>& waiting, const struct timespec* timeout );
+        void notify( std::atomic<uint32_t>& word, std::atomic<uint32_t>& waiting, size_t n );
+
+        IPC::MappedMem<char> mem;
+        Header* header{ nullptr };
+        Slot* slots{ nullptr };
+        bool uninterrupted;
+        bool closed{ false };
+
+        /** Process that registered as writer (forked childs do not unregister). */
+        pid_t writer_pid{ -1 };
+    };
+
+}
+
+/**
+ * Implementation
+ */
+
+template <class T> constexpr size_t IPC::RingQueue<T>::MAX_BATCH;
+template <class T> constexpr size_t IPC::RingQueue<T>::HEADER_SIZE;
+
+
+/**
+ * Creates the ring in shared memory so it's available to the other processes.
+ *
+ * \param filename Name of the queue.
+ * \param capacity Minimum number of elements that the ring holds (rounded to a power of 2).
+ */
+template <class T> void IPC::RingQueue<T>::Create( const std::string& filename, size_t capacity ) {
+    size_t n = 1;
+    while( n < capacity ) {
+        n <<= 1;
+    }
+
+    IPC::MappedMem<char>::Create( RingQueue<T>::Name( filename ), HEADER_SIZE + n * sizeof( Slot ), IPC::MapOptions::none );
+    IPC::MappedMem<char> mem{ RingQueue<T>::Name( filename ), 0, IPC::MapOptions::none };
+
+    /* initializes the ring */
+    Header* header = new( mem.get_ptr( 0 ) ) Header();
+    header->mask = n - 1;
+
+    Slot* slots = reinterpret_cast<Slot *>( mem.get_ptr( HEADER_SIZE ) );
+    for( size_t i = 0; i < n; i++ ) {
+        new( &slots[i].seq ) std::atomic<size_t>( i );
+    }
+
+    LOG_DBG << "new ring queue " << filename << " of " << n << " elements" << std::endl;
+}
+
+/**
+ * Destroys the ring (no other processes will be able to connect again).
+ */
+template <class T> void IPC::RingQueue<T>::Destroy( const std::string& filename ) {
+    IPC::MappedMem<char>::Destroy( RingQueue<T>::Name( filename ) );
+}
+
+template <class T> std::string IPC::RingQueue<T>::Name( const std::string& filename ) {
+    std::string name = "/cv_r" + filename;
+    std::replace( name.begin() + 1, name.end(), '/', '_' );
+    return name;
+}
+
+
+/**
+ * RingQueue constructor implementation.
+ */
+template <class T> IPC::RingQueue<T>::RingQueue( const std::string& filename, IPC::QueueMode mode ) : RingQueue(filename, mode, false) {
+}
+
+template <class T> IPC::RingQueue<T>::RingQueue( const std::string& filename, IPC::QueueMode mode, bool uninterrupted ) : mem(RingQueue<T>::Name( filename ), 0, IPC::MapOptions::none),
+                                                                                                                       uninterrupted(uninterrupted) {
+    this->header = reinterpret_cast<Header *>( this->mem.get_ptr( 0 ) );
+    this->slots = reinterpret_cast<Slot *>( this->mem.get_ptr( HEADER_SIZE ) );
+
+    if( mode == IPC::QueueMode::write ) {
+        this->writer_pid = getpid();
+        this->header->writers.fetch_add( 1 );
+        this->header->writers_seen.store( 1 );
+    }
+}
+
+/**
+ * Move constructor (the writer is unregistered by the new object only).
+ */
+template <class T> IPC::RingQueue<T>::RingQueue( RingQueue&& other ) : mem(std::move( other.mem )),
+                                                                      header(other.header),
+                                                                      slots(other.slots),
+                                                                      uninterrupted(other.uninterrupted),
+                                                                      closed(other.closed) {
+    std::swap( this->writer_pid, other.writer_pid );
+}
+
+/**
+ * RingQueue destructor implementation.
+ * When the last writer leaves, the readers are woken up so they get an EOF.
+ */
+template <class T> IPC::RingQueue<T>::~RingQueue() {
+    if( this->writer_pid != getpid() ) {
+        return;
+    }
+
+    if( this->header->writers.fetch_sub( 1 ) == 1 ) {
+        this->header->not_empty.fetch_add( 1 );
+        IPC::futex_wake( &this->header->not_empty, INT32_MAX );
+    }
+}
+
+
+/**
+ * Inserts an element into the Queue (blocks while the ring is full).
+ *
+ * \param elem Element to insert.
+ */
+template <class T> void IPC::RingQueue<T>::insert( T elem ) {
+    this->insert_many( &elem, 1 );
+}
+
+/**
+ * Gets an element from the Queue (blocks while the ring is empty).
+ *
+ * \return The element removed.
+ */
+template <class T> T IPC::RingQueue<T>::remove() {
+    T rv;
+    this->remove_many( &rv, 1 );
+    return rv;
+}
+
+/**
+ * Inserts many elements into the Queue, blocking while the ring is full.
+ * The readers are woken up once for all the elements copied at a time.
+ *
+ * \param elems Elements to insert.
+ * \param n     Number of elements.
+ * \return The number of elements inserted (less than \a n only if interrupted).
+ */
+template <class T> size_t IPC::RingQueue<T>::insert_many( const T* elems, size_t n ) {
+    /* all the elements share the same timestamp, and are counted before being copied so the
+       readers never see a negative depth */
+    uint64_t stamp = IPC::QueueStats::now();
+    this->header->stats.on_insert( n );
+
+    size_t inserted = 0;
+    while( inserted < n ) {
+        size_t count = 0;
+        while( inserted + count < n && this->push( elems[inserted + count], stamp ) ) {
+            count++;
+        }
+        if( count > 0 ) {
+            inserted += count;
+            this->notify( this->header->not_empty, this->header->readers_waiting, count );
+            continue;
+        }
+
+        /* the ring is full: checks again after being registered as waiting so a wake up can't
+           be lost */
+        uint32_t value = this->header->not_full.load();
+        this->header->writers_waiting.fetch_add( 1 );
+        std::atomic_thread_fence( std::memory_order_seq_cst );
+
+        if( this->push( elems[inserted], stamp ) ) {
+            this->header->writers_waiting.fetch_sub( 1 );
+            inserted++;
+            this->notify( this->header->not_empty, this->header->readers_waiting, 1 );
+            continue;
+        }
+
+        if( !this->wait( this->header->not_full, value, this->header->writers_waiting, nullptr ) ) {
+            this->header->stats.on_insert_failed( n - inserted );
+            if( inserted > 0 ) {
+                return inserted;
+            }
+            throw IPC::QueueError( strerror( EINTR ) );
+        }
+    }
+
+    return inserted;
+}
+
+/**
+ * Gets up to \a n elements from the Queue.
+ * Blocks until at least one element is available and returns everything that is already in
+ * the ring (up to \a n), so a backlog can be drained with a single call.
+ *
+ * \param elems Buffer where the elements are stored.
+ * \param n     Maximum number of elements to read.
+ * \return The number of elements read (at least 1).
+ */
+template <class T> size_t IPC::RingQueue<T>::remove_many( T* elems, size_t n ) {
+    size_t removed = this->wait_remove( elems, n, nullptr );
+    if( removed == 0 ) {
+        if( this->closed ) {
+            throw IPC::QueueEOF();
+        }
+        throw IPC::QueueError( strerror( EINTR ) );
+    }
+    return removed;
+}
+
+/**
+ * Gets an element from the Queue only if there's one available.
+ *
+ * \param elem Where the element is stored.
+ * \return \c true if an element was read.
+ */
+template <class T> bool IPC::RingQueue<T>::try_remove( T& elem ) {
+    return this->remove_for( elem, std::chrono::milliseconds( 0 ) );
+}
+
+/**
+ * Gets an element from the Queue waiting at most \a timeout for it.
+ * Instead of throwing, returns \c false on timeout, when interrupted by a signal (unless the
+ * queue is uninterrupted) or when the queue reached the end (see \c eof).
+ *
+ * \param elem    Where the element is stored.
+ * \param timeout Maximum time to wait.
+ * \return \c true if an element was read.
+ */
+template <class T> bool IPC::RingQueue<T>::remove_for( T& elem, std::chrono::milliseconds timeout ) {
+    auto deadline = std::chrono::steady_clock::now() + timeout;
+    return this->wait_remove( &elem, 1, &deadline ) == 1;
+}
+
+
+/**
+ * Copies an element into the ring without blocking.
+ *
+ * \return \c false if the ring is full.
+ */
+template <class T> bool IPC::RingQueue<T>::push( const T& elem, uint64_t stamp ) {
+    size_t pos = this->header->head.load( std::memory_order_relaxed );
+    Slot* slot;
+
+    while( true ) {
+        slot = &this->slots[pos & this->header->mask];
+        size_t seq = slot->seq.load( std::memory_order_acquire );
+        intptr_t diff = static_cast<intptr_t>( seq ) - static_cast<intptr_t>( pos );
+
+        if( diff == 0 ) {
+            /* the slot is free, tries to claim it */
+            if( this->header->head.compare_exchange_weak( pos, pos + 1, std::memory_order_relaxed ) ) {
+                break;
+            }
+        } else if( diff < 0 ) {
+            /* the slot was not read yet */
+            return false;
+        } else {
+            pos = this->header->head.load( std::memory_order_relaxed );
+        }
+    }
+
+    slot->stamp = stamp;
+    memcpy( &slot->elem, &elem, sizeof( T ) );
+    slot->seq.store( pos + 1, std::memory_order_release );
+    return true;
+}
+
+/**
+ * Copies an element out of the ring without blocking.
+ *
+ * \return \c false if the ring is empty.
+ */
+template <class T> bool IPC::RingQueue<T>::pop( T& elem, uint64_t& stamp ) {
+    size_t pos = this->header->tail.load( std::memory_order_relaxed );
+    Slot* slot;
+
+    while( true ) {
+        slot = &this->slots[pos & this->header->mask];
+        size_t seq = slot->seq.load( std::memory_order_acquire );
+        intptr_t diff = static_cast<intptr_t>( seq ) - static_cast<intptr_t>( pos + 1 );
+
+        if( diff == 0 ) {
+            /* the slot was written, tries to claim it */
+            if( this->header->tail.compare_exchange_weak( pos, pos + 1, std::memory_order_relaxed ) ) {
+                break;
+            }
+        } else if( diff < 0 ) {
+            /* nothing written yet */
+            return false;
+        } else {
+            pos = this->header->tail.load( std::memory_order_relaxed );
+        }
+    }
+
+    stamp = slot->stamp;
+    memcpy( &elem, &slot->elem, sizeof( T ) );
+    slot->seq.store( pos + this->header->mask + 1, std::memory_order_release );
+    return true;
+}
+
+/**
+ * Copies up to \a n elements out of the ring without blocking.
+ *
+ * \return The number of elements copied.
+ */
+template <class T> size_t IPC::RingQueue<T>::pop_many( T* elems, uint64_t* stamps, size_t n ) {
+    size_t count = 0;
+    while( count < n && this->pop( elems[count], stamps[count] ) ) {
+        count++;
+    }
+    return count;
+}
+
+/**
+ * Removes up to \a n elements, blocking until there's at least one.
+ *
+ * \param deadline When to stop waiting (\c nullptr waits until an element arrives).
+ * \return The number of elements removed, 0 on timeout, when interrupted (unless the queue is
+ *         uninterrupted) or at the end of the queue (then \c eof returns \c true).
+ */
+template <class T> size_t IPC::RingQueue<T>::wait_remove( T* elems, size_t n, const std::chrono::steady_clock::time_point* deadline ) {
+    uint64_t stamps[MAX_BATCH];
+    n = std::min( n, MAX_BATCH );
+
+    size_t removed = this->pop_many( elems, stamps, n );
+    while( removed == 0 ) {
+        uint32_t value = this->header->not_empty.load();
+        this->header->readers_waiting.fetch_add( 1 );
+        std::atomic_thread_fence( std::memory_order_seq_cst );
+
+        removed = this->pop_many( elems, stamps, n );
+        if( removed > 0 ) {
+            this->header->readers_waiting.fetch_sub( 1 );
+            break;
+        }
+
+        /* empty and no writers left */
+        if( this->header->writers_seen.load() && this->header->writers.load() == 0 ) {
+            this->header->readers_waiting.fetch_sub( 1 );
+            this->closed = true;
+            return 0;
+        }
+
+        struct timespec timeout;
+        if( deadline != nullptr ) {
+            auto left = std::chrono::duration_cast<std::chrono::nanoseconds>( *deadline - std::chrono::steady_clock::now() ).count();
+            if( left <= 0 ) {
+                this->header->readers_waiting.fetch_sub( 1 );
+                return 0;
+            }
+            timeout.tv_sec = left / 1000000000;
+            timeout.tv_nsec = left % 1000000000;
+        }
+
+        if( !this->wait( this->header->not_empty, value, this->header->readers_waiting, deadline != nullptr ? &timeout : nullptr ) ) {
+            return 0;
+        }
+        removed = this->pop_many( elems, stamps, n );
+    }
+
+    this->header->stats.on_remove( stamps, removed, IPC::QueueStats::now() );
+    this->notify( this->header->not_full, this->header->writers_waiting, removed );
+    return removed;
+}
+
+/**
+ * Blocks on the futex word while it keeps the given value.
+ *
+ * \return \c false if interrupted by a signal (and the queue is not uninterrupted).
+ */
+template <class T> bool IPC::RingQueue<T>::wait( std::atomic<uint32_t>& word, uint32_t value, std::atomic<uint32_t>& waiting, const struct timespec* timeout ) {
+    int rv = IPC::futex_wait( &word, value, timeout );
+    int error = errno;
+    waiting.fetch_sub( 1 );
+
+    return !( rv < 0 && error == EINTR && !this->uninterrupted );
+}
+
+/**
+ * Wakes up to \a n processes blocked on the futex word (only if there's someone waiting).
+ */
+template <class T> void IPC::RingQueue<T>::notify( std::atomic<uint32_t>& word, std::atomic<uint32_t>& waiting, size_t n ) {
+    std::atomic_thread_fence( std::memory_order_seq_cst );
+    if( waiting.load() > 0 ) {
+        word.fetch_add( 1 );
+        IPC::futex_wake( &word, static_cast<int>( std::min<size_t>( n, INT32_MAX ) ) );
+    }
+}
+
+
+#endif
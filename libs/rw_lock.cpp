@@ -0,0 +1,247 @@
+/* include area */
+#include "rw_lock.hpp"
+#include "futex.hpp"
+#include <algorithm>
+#include <errno.h>
+#include <pthread.h>
+#include <string.h>
+
+using IPC::RWLock;
+
+
+/* layout of the lock word */
+static const uint32_t WRITER = 1u << 31;
+static const uint32_t WAITERS = 1u << 30;
+/* a reader is waiting to upgrade to a write lock (only one can) */
+static const uint32_t UPGRADER = 1u << 29;
+static const uint32_t READERS = UPGRADER - 1;
+
+
+/**
+ * Locks held by this process (the shared word counts each process once), kept in a small fixed
+ * table so taking a lock never allocates.
+ */
+struct _Holds {
+    const void* word;
+    uint32_t reads;
+    uint32_t writes;
+};
+
+static const size_t MAX_HOLDS = 64;
+static _Holds _holds[MAX_HOLDS];
+/* slots used at some point (the free slots before it have a null word) */
+static size_t _used = 0;
+
+static void _clear_holds() {
+    memset( _holds, 0, sizeof( _holds ) );
+    _used = 0;
+}
+
+/* the locks belong to the parent, not to the forked children */
+static const int _registered = pthread_atfork( nullptr, nullptr, _clear_holds );
+
+static _Holds* _find_holds( const void* word ) {
+    for( size_t i = 0; i < _used; i++ ) {
+        if( _holds[i].word == word ) {
+            return &_holds[i];
+        }
+    }
+    return nullptr;
+}
+
+static _Holds* _get_holds( const void* word ) {
+    _Holds* holds = _find_holds( word );
+    if( holds != nullptr ) {
+        return holds;
+    }
+
+    for( size_t i = 0; i < MAX_HOLDS; i++ ) {
+        if( _holds[i].word == nullptr ) {
+            _holds[i] = { word, 0, 0 };
+            _used = std::max( _used, i + 1 );
+            return &_holds[i];
+        }
+    }
+    throw RWLock::Error( "too many locks held by the process" );
+}
+
+static void _release_holds( _Holds* holds ) {
+    holds->word = nullptr;
+    while( _used > 0 && _holds[_used - 1].word == nullptr ) {
+        _used--;
+    }
+}
+
+
+/**
+ * Blocks until the word changes, flagging that there are processes waiting.
+ */
+static void _wait( std::atomic<uint32_t>* word, uint32_t value ) {
+    if( !( value & WAITERS ) && !word->compare_exchange_strong( value, value | WAITERS ) ) {
+        /* the word changed, no need to wait */
+        return;
+    }
+
+    if( IPC::futex_wait( word, value | WAITERS ) < 0 && errno != EAGAIN && errno != EINTR ) {
+        throw RWLock::Error( "futex_wait: " + static_cast<std::string>( strerror( errno ) ) );
+    }
+}
+
+/**
+ * Wakes the waiting processes if the word had the flag (the flag is cleared).
+ */
+static void _wake( std::atomic<uint32_t>* word, uint32_t value ) {
+    if( value & WAITERS ) {
+        word->fetch_and( ~WAITERS );
+        IPC::futex_wake( word, INT32_MAX );
+    }
+}
+
+static void _lock_read( std::atomic<uint32_t>* word ) {
+    uint32_t value = word->load( std::memory_order_relaxed );
+    while( true ) {
+        if( !( value & WRITER ) ) {
+            if( word->compare_exchange_weak( value, value + 1, std::memory_order_acquire ) ) {
+                return;
+            }
+            continue;
+        }
+        _wait( word, value );
+        value = word->load( std::memory_order_relaxed );
+    }
+}
+
+/**
+ * Takes the write lock when the word has no writer and \a readers readers (the ones of this process).
+ * A process that upgrades its read lock waits for the other readers to leave, so two processes
+ * upgrading at once would wait for each other forever: the second one fails (as \c EDEADLK with
+ * \c fcntl).
+ */
+static void _lock_write( std::atomic<uint32_t>* word, uint32_t readers ) {
+    uint32_t value = word->load( std::memory_order_relaxed );
+    if( readers > 0 ) {
+        do {
+            if( value & UPGRADER ) {
+                throw RWLock::Error( "deadlock: another process is upgrading its read lock" );
+            }
+        } while( !word->compare_exchange_weak( value, value | UPGRADER, std::memory_order_relaxed ) );
+        value |= UPGRADER;
+    }
+
+    while( true ) {
+        if( !( value & WRITER ) && ( value & READERS ) == readers ) {
+            /* the upgrade flag is cleared when the lock is taken */
+            if( word->compare_exchange_weak( value, ( value & WAITERS ) | WRITER, std::memory_order_acquire ) ) {
+                return;
+            }
+            continue;
+        }
+        _wait( word, value );
+        value = word->load( std::memory_order_relaxed );
+    }
+}
+
+static void _unlock_read( std::atomic<uint32_t>* word ) {
+    uint32_t value = word->fetch_sub( 1, std::memory_order_release ) - 1;
+
+    /* a process upgrading its lock waits to be the only reader left */
+    if( ( value & READERS ) == 0 || ( ( value & UPGRADER ) && ( value & READERS ) == 1 ) ) {
+        _wake( word, value );
+    }
+}
+
+/**
+ * Releases the write lock, keeping \a readers readers (the ones of this process).
+ */
+static void _unlock_write( std::atomic<uint32_t>* word, uint32_t readers ) {
+    uint32_t value = word->load( std::memory_order_relaxed );
+    while( !word->compare_exchange_weak( value, ( value & WAITERS ) | readers, std::memory_order_release ) ) {
+    }
+    _wake( word, value );
+}
+
+
+/**
+ * Constructor implementation: takes the lock.
+ *
+ * \param word Lock word in shared memory.
+ * \param mode Lock mode.
+ */
+RWLock::RWLock( std::atomic<uint32_t>* word, RWLock::Mode mode ) : word(word), mode(mode) {
+    _Holds& holds = *_get_holds( word );
+
+    try {
+        if( mode == RWLock::Mode::read ) {
+            if( holds.reads == 0 && holds.writes == 0 ) {
+                _lock_read( word );
+            }
+            holds.reads++;
+        } else {
+            if( holds.writes == 0 ) {
+                /* upgrades the read lock of this process if it has one */
+                _lock_write( word, holds.reads > 0 ? 1 : 0 );
+            }
+            holds.writes++;
+        }
+    } catch( const RWLock::Error& e ) {
+        if( holds.reads == 0 && holds.writes == 0 ) {
+            _release_holds( &holds );
+        }
+        throw;
+    }
+}
+
+/**
+ * Move constructor.
+ */
+RWLock::RWLock( RWLock&& other ) : mode(other.mode) {
+    std::swap( this->word, other.word );
+}
+
+/**
+ * Destructor implementation: releases the lock.
+ */
+RWLock::~RWLock() {
+    this->release();
+}
+
+RWLock& RWLock::operator=( RWLock&& other ) {
+    this->release();
+    this->word = other.word;
+    this->mode = other.mode;
+    other.word = nullptr;
+    return *this;
+}
+
+
+void RWLock::release() {
+    if( this->word == nullptr ) {
+        return;
+    }
+
+    _Holds* found = _find_holds( this->word );
+    if( found == nullptr ) {
+        /* taken before forking: belongs to the parent */
+        this->word = nullptr;
+        return;
+    }
+
+    _Holds& holds = *found;
+    if( this->mode == RWLock::Mode::read ) {
+        holds.reads--;
+        if( holds.reads == 0 && holds.writes == 0 ) {
+            _unlock_read( this->word );
+        }
+    } else {
+        holds.writes--;
+        if( holds.writes == 0 ) {
+            /* downgrades to a read lock if this process still reads */
+            _unlock_write( this->word, holds.reads > 0 ? 1 : 0 );
+        }
+    }
+
+    if( holds.reads == 0 && holds.writes == 0 ) {
+        _release_holds( &holds );
+    }
+    this->word = nullptr;
+}
@@ -0,0 +1,53 @@
+#ifndef RW_LOCK_HPP
+#define RW_LOCK_HPP
+
+/* include area */
+#include "ipc.hpp"
+#include <atomic>
+#include <stdint.h>
+#include <string>
+
+
+namespace IPC {
+
+    /**
+     * A reader-writer lock on a 32 bit word placed in shared memory (initialized with 0).
+     * Taking and releasing a free lock is a single atomic operation; processes only go to the
+     * kernel (with a futex) when they have to wait.
+     * As with \c IPC::Lock, the lock is held by the process: a process that holds it can take it
+     * again in any mode (a read lock is upgraded when a write lock is taken), and a forked child
+     * does not inherit the locks of its parent. Only one process can upgrade at a time: the others
+     * that try get an \c Error (they would wait for each other forever).
+     * Unlike the \c fcntl locks, the lock of a process that dies is not released: the processes
+     * that share the word must release their locks before exiting (they are released when the
+     * objects are destroyed, also when an exception unwinds the stack).
+     */
+    class RWLock {
+    public:
+        class Error : public IPC::Error {
+        public:
+            Error( const std::string& message ) : IPC::Error(message) {}
+            ~Error() {}
+        };
+
+        enum class Mode { read, write };
+
+        RWLock( const RWLock& other ) = delete;
+        RWLock( std::atomic<uint32_t>* word, Mode mode );
+        RWLock( RWLock&& other );
+        ~RWLock();
+
+        RWLock& operator=( RWLock& other ) = delete;
+        RWLock& operator=( const RWLock& other ) = delete;
+        RWLock& operator=( RWLock&& other );
+
+    private:
+        void release();
+
+        std::atomic<uint32_t>* word{ nullptr };
+        Mode mode;
+    };
+}
+
+
+#endif
@@ -0,0 +1,168 @@
+/* include area */
+#include "selector.hpp"
+#include "log.hpp"
+#include <errno.h>
+#include <signal.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+using std::string;
+using std::endl;
+
+
+/** Maximum number of events handled per call to epoll_wait. */
+static const int MAX_EVENTS = 32;
+
+
+/**
+ * Constructor implementation.
+ */
+IPC::Selector::Selector() {
+    this->epfd = epoll_create1( EPOLL_CLOEXEC );
+    if( this->epfd < 0 )
+        throw IPC::Selector::Error( "epoll_create1: " + static_cast<string>( strerror( errno ) ) );
+}
+
+/**
+ * Destructor implementation.
+ */
+IPC::Selector::~Selector() {
+    for( int fd: this->owned ) {
+        close( fd );
+    }
+
+    if( this->epfd >= 0 )
+        close( this->epfd );
+    this->epfd = -1;
+}
+
+
+/**
+ * Registers a signal. The signal is blocked so it's only received through the selector.
+ *
+ * \param signum   Signal number.
+ * \param callback Function called with the signal number each time it's received.
+ */
+void IPC::Selector::add_signal( int signum, std::function<void( int )> callback ) {
+    sigset_t mask;
+    sigemptyset( &mask );
+    sigaddset( &mask, signum );
+
+    if( sigprocmask( SIG_BLOCK, &mask, NULL ) < 0 )
+        throw IPC::Selector::Error( "sigprocmask: " + static_cast<string>( strerror( errno ) ) );
+
+    int fd = signalfd( -1, &mask, SFD_CLOEXEC );
+    if( fd < 0 )
+        throw IPC::Selector::Error( "signalfd: " + static_cast<string>( strerror( errno ) ) );
+
+    this->owned.insert( fd );
+    this->add_fd( fd, [fd, callback]() {
+        struct signalfd_siginfo info;
+        if( read( fd, &info, sizeof( info ) ) == sizeof( info ) ) {
+            callback( info.ssi_signo );
+        }
+    } );
+}
+
+/**
+ * Registers a periodic timer.
+ *
+ * \param period   Time between calls.
+ * \param callback Function called each time the timer expires.
+ */
+void IPC::Selector::add_timer( std::chrono::milliseconds period, std::function<void()> callback ) {
+    int fd = timerfd_create( CLOCK_MONOTONIC, TFD_CLOEXEC );
+    if( fd < 0 )
+        throw IPC::Selector::Error( "timerfd_create: " + static_cast<string>( strerror( errno ) ) );
+
+    struct itimerspec spec;
+    spec.it_interval.tv_sec = period.count() / 1000;
+    spec.it_interval.tv_nsec = ( period.count() % 1000 ) * 1000000;
+    spec.it_value = spec.it_interval;
+
+    if( timerfd_settime( fd, 0, &spec, NULL ) < 0 ) {
+        close( fd );
+        throw IPC::Selector::Error( "timerfd_settime: " + static_cast<string>( strerror( errno ) ) );
+    }
+
+    this->owned.insert( fd );
+    this->add_fd( fd, [fd, callback]() {
+        uint64_t expirations;
+        if( read( fd, &expirations, sizeof( expirations ) ) == sizeof( expirations ) ) {
+            callback();
+        }
+    } );
+}
+
+
+/**
+ * Waits until at least one source is ready (or the timeout expires) and calls the callbacks of the
+ * sources that are ready.
+ *
+ * \param timeout_ms Maximum time to wait in milliseconds (-1 waits forever).
+ * \return Number of callbacks called (0 on timeout or if interrupted by a signal).
+ */
+size_t IPC::Selector::dispatch( int timeout_ms ) {
+    struct epoll_event events[MAX_EVENTS];
+
+    int n = epoll_wait( this->epfd, events, MAX_EVENTS, timeout_ms );
+    if( n < 0 ) {
+        if( errno == EINTR ) {
+            return 0;
+        }
+        throw IPC::Selector::Error( "epoll_wait: " + static_cast<string>( strerror( errno ) ) );
+    }
+
+    size_t dispatched = 0;
+    for( int i = 0; i < n; i++ ) {
+        /* a previous callback may have removed the source */
+        auto it = this->handlers.find( events[i].data.fd );
+        if( it == this->handlers.end() ) {
+            continue;
+        }
+
+        auto handler = it->second;
+        ( *handler )();
+        dispatched++;
+    }
+
+    return dispatched;
+}
+
+
+/**
+ * Registers a file descriptor to wait until it's readable.
+ */
+void IPC::Selector::add_fd( int fd, std::function<void()> callback ) {
+    struct epoll_event event;
+    memset( &event, 0, sizeof( event ) );
+    event.events = EPOLLIN;
+    event.data.fd = fd;
+
+    if( epoll_ctl( this->epfd, EPOLL_CTL_ADD, fd, &event ) < 0 )
+        throw IPC::Selector::Error( "epoll_ctl: " + static_cast<string>( strerror( errno ) ) );
+
+    this->handlers[fd] = std::make_shared<std::function<void()>>( callback );
+    LOG_DBG << "selector: added fd " << fd << endl;
+}
+
+/**
+ * Unregisters a file descriptor.
+ */
+void IPC::Selector::remove_fd( int fd ) {
+    if( this->handlers.erase( fd ) == 0 ) {
+        return;
+    }
+
+    if( epoll_ctl( this->epfd, EPOLL_CTL_DEL, fd, NULL ) < 0 )
+        LOG_DBG << "epoll_ctl: " << strerror( errno ) << endl;
+
+    if( this->owned.erase( fd ) > 0 ) {
+        close( fd );
+    }
+    LOG_DBG << "selector: removed fd " << fd << endl;
+}
@@ -0,0 +1,110 @@
+/**
+ * Waits on many event sources (queues, signals and timers) from a single process.
+ */
+
+#ifndef SELECTOR_HPP
+#define SELECTOR_HPP
+
+/* include area */
+#include "ipc.hpp"
+#include "queue.hpp"
+#include <chrono>
+#include <functional>
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+
+
+namespace IPC {
+
+    /**
+     * Multiplexes event sources over one epoll instance and dispatches a callback for each source
+     * that becomes ready.
+     */
+    class Selector {
+    public:
+        /**
+         * Selector errors.
+         */
+        class Error : public IPC::Error {
+        public:
+            Error( const std::string& message ) : IPC::Error( message ) {}
+            ~Error() {}
+        };
+
+        Selector();
+        Selector( const Selector& other ) = delete;
+        Selector& operator=( const Selector& other ) = delete;
+        ~Selector();
+
+        /** The callback is called each time the queue has data (it has to read from it). */
+        template <class T> void add( const Queue<T>& queue, std::function<void()> callback );
+
+        /** The callback is called for each element read. The queue is removed when it reaches the end. */
+        template <class T> void add_reader( Queue<T>& queue, std::function<void( const T& )> callback );
+
+        /** The signal is blocked and handled through the selector. */
+        void add_signal( int signum, std::function<void( int )> callback );
+
+        /** The callback is called periodically. */
+        void add_timer( std::chrono::milliseconds period, std::function<void()> callback );
+
+        /** Stops watching the queue. */
+        template <class T> void remove( const Queue<T>& queue ) { this->remove_fd( queue.get_fd() ); }
+
+        /** Waits for the sources to be ready and dispatches the callbacks. */
+        size_t dispatch( int timeout_ms = -1 );
+
+        /** Returns the number of sources registered. */
+        size_t size() const { return this->handlers.size(); }
+
+    private:
+        void add_fd( int fd, std::function<void()> callback );
+        void remove_fd( int fd );
+
+        /** The epoll file descriptor. */
+        int epfd{ -1 };
+
+        /** Callbacks of each file descriptor registered (shared so a callback can remove itself). */
+        std::map<int, std::shared_ptr<std::function<void()>>> handlers;
+
+        /** File descriptors created by the selector (signals and timers). */
+        std::set<int> owned;
+    };
+}
+
+
+/**
+ * Registers a queue in the selector.
+ *
+ * \param queue    Queue to watch.
+ * \param callback Function called when the queue has data to read.
+ */
+template <class T> void IPC::Selector::add( const IPC::Queue<T>& queue, std::function<void()> callback ) {
+    this->add_fd( queue.get_fd(), callback );
+}
+
+/**
+ * Registers a queue in the selector, reading every element available each time it's ready.
+ *
+ * \param queue    Queue to read from.
+ * \param callback Function called with each element read.
+ */
+template <class T> void IPC::Selector::add_reader( IPC::Queue<T>& queue, std::function<void( const T& )> callback ) {
+    IPC::Queue<T>* q = &queue;
+    this->add_fd( queue.get_fd(), [this, q, callback]() {
+        T elem;
+        while( q->try_remove( elem ) ) {
+            callback( elem );
+        }
+
+        /* all the writers left */
+        if( q->eof() ) {
+            this->remove_fd( q->get_fd() );
+        }
+    } );
+}
+
+
+#endif
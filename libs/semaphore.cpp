@@ -0,0 +1,179 @@
+/* include area */
+#include "semaphore.hpp"
+#include "log.hpp"
+#include <errno.h>
+#include <string.h>
+
+using std::endl;
+using std::string;
+using std::vector;
+
+
+/**
+ * Creates a new set of semaphores with all the counters in 0.
+ *
+ * \param key Key of the IPC resource.
+ * \param n   Number of counters.
+ */
+void IPC::Semaphore::Create( IPC::Key key, size_t n ) {
+    int semid = semget( key.value, n, 0644 | IPC_CREAT | IPC_EXCL );
+    if( semid < 0 )
+        throw IPC::Semaphore::Error( static_cast<string>( "semget: " ) + strerror( errno ) );
+
+    vector<unsigned short> values( n, 0 );
+    if( semctl( semid, 0, SETALL, values.data() ) < 0 )
+        throw IPC::Semaphore::Error( static_cast<string>( "semctl: " ) + strerror( errno ) );
+
+    LOG_DBG << "semaphore semid: " << semid << endl;
+}
+
+/**
+ * Destroys a semaphore set created before, deallocating the OS resources.
+ *
+ * \param key Key of the IPC resource.
+ */
+void IPC::Semaphore::Destroy( IPC::Key key ) {
+    int semid = semget( key.value, 0, 0644 );
+    if( semid < 0 ) {
+        LOG_DBG << strerror( errno ) << " - key=" << key << endl;
+        return;
+    }
+
+    LOG_DBG << "destroy: " << semid << " - key=" << key << endl;
+    semctl( semid, 0, IPC_RMID, NULL );
+}
+
+
+/**
+ * Constructor implementation.
+ */
+IPC::Semaphore::Semaphore( IPC::Key key ) : Semaphore(key, false) {
+}
+
+IPC::Semaphore::Semaphore( IPC::Key key, bool undo ) : flags(undo ? SEM_UNDO : 0) {
+    this->semid = semget( key.value, 0, 0644 );
+    if( this->semid < 0 )
+        throw IPC::Semaphore::Error( static_cast<string>( "semget: " ) + strerror( errno ) );
+
+    struct semid_ds info;
+    if( semctl( this->semid, 0, IPC_STAT, &info ) < 0 )
+        throw IPC::Semaphore::Error( static_cast<string>( "semctl: " ) + strerror( errno ) );
+    this->n = info.sem_nsems;
+}
+
+/**
+ * Destructor implementation.
+ */
+IPC::Semaphore::~Semaphore() {
+}
+
+
+/**
+ * Adds to the counters in a single operation.
+ *
+ * \param indexes Counters to increment.
+ * \param n       Amount added to each counter.
+ */
+void IPC::Semaphore::post( std::initializer_list<size_t> indexes, short n ) {
+    vector<struct sembuf> sops;
+    for( size_t index: indexes ) {
+        sops.push_back( { static_cast<unsigned short>( index ), n, this->flags } );
+    }
+
+    while( !this->operate( sops ) ) {
+        /* retries if interrupted, so the counters are never lost */
+    }
+}
+
+/**
+ * Takes from a counter, blocking while it's not enough.
+ *
+ * \param index Counter to decrement.
+ * \param n     Amount to take.
+ * \return \c false if interrupted by a signal.
+ */
+bool IPC::Semaphore::wait( size_t index, short n ) {
+    vector<struct sembuf> sops{ { static_cast<unsigned short>( index ), static_cast<short>( -n ), this->flags } };
+    return this->operate( sops );
+}
+
+/**
+ * Takes from a counter only if it has enough.
+ *
+ * \param index Counter to decrement.
+ * \param n     Amount to take.
+ * \return \c true if taken.
+ */
+bool IPC::Semaphore::try_wait( size_t index, short n ) {
+    vector<struct sembuf> sops{ { static_cast<unsigned short>( index ), static_cast<short>( -n ), static_cast<short>( IPC_NOWAIT | this->flags ) } };
+    return this->operate( sops );
+}
+
+/**
+ * Takes from many counters in a single operation, only if all of them have enough.
+ *
+ * \param amounts Amount to take from each counter.
+ * \return \c true if taken.
+ */
+bool IPC::Semaphore::try_wait( const vector<short>& amounts ) {
+    vector<struct sembuf> sops;
+    for( size_t i = 0; i < amounts.size(); i++ ) {
+        if( amounts[i] > 0 ) {
+            sops.push_back( { static_cast<unsigned short>( i ), static_cast<short>( -amounts[i] ), static_cast<short>( IPC_NOWAIT | this->flags ) } );
+        }
+    }
+
+    return sops.empty() || this->operate( sops );
+}
+
+/**
+ * Adds \a n to each counter without undo and takes it back with undo in the same operation: the
+ * values don't change, and the undo of the process is reduced by \a n.
+ *
+ * \param indexes Counters whose changes are kept.
+ * \param n       Amount kept in each counter.
+ */
+void IPC::Semaphore::keep( std::initializer_list<size_t> indexes, short n ) {
+    if( this->flags == 0 ) {
+        return;
+    }
+
+    vector<struct sembuf> sops;
+    for( size_t index: indexes ) {
+        sops.push_back( { static_cast<unsigned short>( index ), n, 0 } );
+    }
+    for( size_t index: indexes ) {
+        sops.push_back( { static_cast<unsigned short>( index ), static_cast<short>( -n ), SEM_UNDO } );
+    }
+
+    while( !this->operate( sops ) ) {
+        /* retries if interrupted, like post */
+    }
+}
+
+/**
+ * Gets the value of every counter with a single call.
+ */
+vector<unsigned short> IPC::Semaphore::values() const {
+    vector<unsigned short> values( this->n );
+    if( semctl( this->semid, 0, GETALL, values.data() ) < 0 )
+        throw IPC::Semaphore::Error( static_cast<string>( "semctl: " ) + strerror( errno ) );
+
+    return values;
+}
+
+
+/**
+ * Runs the operations.
+ *
+ * \return \c false if interrupted or if it would block with \c IPC_NOWAIT.
+ */
+bool IPC::Semaphore::operate( vector<struct sembuf>& sops ) {
+    if( semop( this->semid, sops.data(), sops.size() ) < 0 ) {
+        if( errno == EINTR || errno == EAGAIN ) {
+            return false;
+        }
+        throw IPC::Semaphore::Error( static_cast<string>( "semop: " ) + strerror( errno ) );
+    }
+    return true;
+}
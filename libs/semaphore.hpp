@@ -0,0 +1,80 @@
+#ifndef SEMAPHORE_HPP
+#define SEMAPHORE_HPP
+
+
+/* include area */
+#include "ipc.hpp"
+#include <initializer_list>
+#include <string>
+#include <sys/ipc.h>
+#include <sys/sem.h>
+#include <vector>
+
+using std::size_t;
+
+
+namespace IPC {
+
+    /**
+     * A set of counting semaphores. Operations on many counters of the set are atomic.
+     */
+    class Semaphore {
+
+    public:
+        /**
+         * Class used for Semaphore exceptions.
+         */
+        class Error : public IPC::Error {
+            public:
+                Error( const std::string& message ) : IPC::Error( message ) {}
+                ~Error() {}
+        };
+
+        /** Static methods used to create (with all the counters in 0) and destroy the IPC resources */
+        static void Create( IPC::Key key, size_t n );
+        static void Destroy( IPC::Key key );
+
+        /** Creates a semaphore object (already initialized by another process) */
+        Semaphore( IPC::Key key );
+
+        /**
+         * If \a undo is \c true, the changes made through the object are undone by the system when
+         * the process exits (also if it crashes), unless they are kept with \c keep.
+         */
+        Semaphore( IPC::Key key, bool undo );
+        ~Semaphore();
+
+        /** Adds \a n to each of the counters. */
+        void post( std::initializer_list<size_t> indexes, short n = 1 );
+
+        /** Takes \a n from the counter, blocking until possible (\c false if interrupted). */
+        bool wait( size_t index, short n = 1 );
+
+        /** Takes from the counters only if all of them have enough (amounts[i] is taken from counter i). */
+        bool try_wait( size_t index, short n );
+        bool try_wait( const std::vector<short>& amounts );
+
+        /**
+         * Leaves the counters as they are, but \a n of the changes made to each of them are no longer
+         * undone when the process exits (see \c Semaphore(IPC::Key, bool)).
+         */
+        void keep( std::initializer_list<size_t> indexes, short n = 1 );
+
+        /** Returns the value of all the counters. */
+        std::vector<unsigned short> values() const;
+
+    private:
+        bool operate( std::vector<struct sembuf>& sops );
+
+        /** The internal semaphore ID */
+        int semid{ -1 };
+
+        /** Number of counters */
+        size_t n{ 0 };
+
+        /** Flags of the operations (\c SEM_UNDO if the changes are undone at exit). */
+        short flags{ 0 };
+    };
+}
+
+#endif
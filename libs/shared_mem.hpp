@@ -35,8 +35,13 @@ namespace IPC {
         
         /** Class methods. */
         SharedMem(IPC::Key key, size_t n );
+        SharedMem(IPC::Key key );
         ~SharedMem();
 
+        SharedMem( const SharedMem& other ) = delete;
+        SharedMem( SharedMem&& other );
+        SharedMem& operator=( const SharedMem& other ) = delete;
+
         void write( size_t index, const T* elems, size_t num_elems );
         void read( size_t index, T* elems, size_t num_elems );
 
@@ -46,8 +51,12 @@ namespace IPC {
         /** Initializes allocated memory with zeros. */
         void set_zero();
 
+        /** Returns the number of elements allocated. */
+        size_t size() const { return this->n; }
+
         /** Derreference operator so this class simulates a pointer. */
         T& operator*();
+        T* operator->() { return this->data; }
         T& operator[]( size_t index );
 
     private:
@@ -116,6 +125,43 @@ template <typename T> IPC::SharedMem<T>::SharedMem( IPC::Key key, size_t n ) : n
     this->data = static_cast<T *>( ptr );
 }
 
+/**
+ * Attaches to the whole segment (the number of elements is taken from the segment size).
+ *
+ * \param key Key associated to the resource.
+ */
+template <typename T> IPC::SharedMem<T>::SharedMem( IPC::Key key ) {
+    /* gets the resource ID */
+    int shmid = shmget( key.value, 0, 0644 );
+    if( shmid < 0 )
+        throw IPC::SharedMemError( "shmget: " + static_cast<std::string>( strerror( errno ) ) );
+
+    /* gets the size of the segment */
+    struct shmid_ds info;
+    if( shmctl( shmid, IPC_STAT, &info ) < 0 )
+        throw IPC::SharedMemError( "shmctl: " + static_cast<std::string>( strerror( errno ) ) );
+
+    /* attaches to the shared memory */
+    void* ptr = shmat( shmid, NULL, 0 );
+    if ( ptr == ( void *) -1 ) {
+        throw IPC::SharedMemError( "shmid: " + static_cast<std::string>( strerror( errno ) ) );
+    }
+
+    /* initializes the object */
+    this->n = info.shm_segsz / sizeof( T );
+    this->shmid = shmid;
+    this->data = static_cast<T *>( ptr );
+}
+
+/**
+ * Move constructor.
+ */
+template <typename T> IPC::SharedMem<T>::SharedMem( SharedMem&& other ) {
+    std::swap( this->shmid, other.shmid );
+    std::swap( this->data, other.data );
+    std::swap( this->n, other.n );
+}
+
 /**
  * Destructor implementation.
  */
@@ -157,7 +203,7 @@ template <typename T> T* IPC::SharedMem<T>::get_ptr( size_t index ) {
 
 
 template <typename T> void IPC::SharedMem<T>::set_zero() {
-    memset( this->data, 0, this->n );
+    memset( this->data, 0, sizeof( T ) * this->n );
 }
 
 
@@ -0,0 +1,194 @@
+/* include area */
+#include "argparser.hpp"
+#include "ipc.hpp"
+#include "log.hpp"
+#include "match.hpp"
+#include "mqueue.hpp"
+#include "process.hpp"
+#include "queue.hpp"
+#include "ring_queue.hpp"
+#include <chrono>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+using std::cout;
+using std::endl;
+using std::string;
+using std::vector;
+using IPC::Resource;
+
+
+/** Names of the queues used by the benchmark. */
+static const string FIFO_NAME = "/tmp/cv_bench_fifo";
+static const string MQUEUE_NAME = "/cv_bench_mqueue";
+static const string RING_NAME = "/tmp/cv_bench_ring";
+
+/** Elements held by the ring (about as many as the pipe buffer of the FIFO). */
+static const size_t RING_CAPACITY = 1024;
+
+/** Number of elements moved per call in the batched runs. */
+static const size_t BATCH = 64;
+
+
+/**
+ * Measures the time taken by a writer process to send \a n elements to the reader (this process).
+ *
+ * \param name   Name of the transport shown in the results.
+ * \param n      Number of elements sent.
+ * \param writer Function executed in the writer process.
+ * \param reader Function executed in this process, must return after \a n elements were read.
+ */
+static void _run( const string& name, size_t n, std::function<void()> writer, std::function<void()> reader ) {
+    auto start = std::chrono::steady_clock::now();
+    {
+        IPC::Process proc{ writer };
+        reader();
+    }
+    auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>( std::chrono::steady_clock::now() - start );
+
+    double secs = elapsed.count() / 1e6;
+    cout << std::left << std::setw( 16 ) << name
+         << std::right << std::setw( 12 ) << static_cast<size_t>( n / secs ) << " msg/s"
+         << std::setw( 10 ) << std::fixed << std::setprecision( 1 ) << elapsed.count() * 1000.0 / n << " ns/msg" << endl;
+}
+
+
+static void _bench_fifo( size_t n ) {
+    Resource<IPC::Queue<Match>, string> res{ FIFO_NAME };
+
+    _run( "fifo", n, [n](){
+        IPC::Queue<Match> out{ FIFO_NAME, IPC::QueueMode::write };
+        for( size_t i = 0; i < n; i++ ) {
+            out.insert( Match{} );
+        }
+    }, [](){
+        IPC::Queue<Match> in{ FIFO_NAME, IPC::QueueMode::read };
+        try {
+            while( true ) {
+                in.remove();
+            }
+        } catch( const IPC::QueueEOF& e ) {
+        }
+    } );
+}
+
+static void _bench_fifo_batched( size_t n ) {
+    Resource<IPC::Queue<Match>, string> res{ FIFO_NAME };
+
+    _run( "fifo (batched)", n, [n](){
+        IPC::Queue<Match> out{ FIFO_NAME, IPC::QueueMode::write };
+        vector<Match> batch( BATCH );
+        for( size_t i = 0; i < n; i += BATCH ) {
+            out.insert_many( batch.data(), std::min( BATCH, n - i ) );
+        }
+    }, [](){
+        IPC::Queue<Match> in{ FIFO_NAME, IPC::QueueMode::read };
+        vector<Match> batch( BATCH );
+        try {
+            while( true ) {
+                in.remove_many( batch.data(), BATCH );
+            }
+        } catch( const IPC::QueueEOF& e ) {
+        }
+    } );
+}
+
+static void _bench_ring( size_t n ) {
+    Resource<IPC::RingQueue<Match>, string> res{ RING_NAME, RING_CAPACITY };
+
+    _run( "ring", n, [n](){
+        IPC::RingQueue<Match> out{ RING_NAME, IPC::QueueMode::write };
+        for( size_t i = 0; i < n; i++ ) {
+            out.insert( Match{} );
+        }
+    }, [](){
+        IPC::RingQueue<Match> in{ RING_NAME, IPC::QueueMode::read };
+        try {
+            while( true ) {
+                in.remove();
+            }
+        } catch( const IPC::QueueEOF& e ) {
+        }
+    } );
+}
+
+static void _bench_ring_batched( size_t n ) {
+    Resource<IPC::RingQueue<Match>, string> res{ RING_NAME, RING_CAPACITY };
+
+    _run( "ring (batched)", n, [n](){
+        IPC::RingQueue<Match> out{ RING_NAME, IPC::QueueMode::write };
+        vector<Match> batch( BATCH );
+        for( size_t i = 0; i < n; i += BATCH ) {
+            out.insert_many( batch.data(), std::min( BATCH, n - i ) );
+        }
+    }, [](){
+        IPC::RingQueue<Match> in{ RING_NAME, IPC::QueueMode::read };
+        vector<Match> batch( BATCH );
+        try {
+            while( true ) {
+                in.remove_many( batch.data(), BATCH );
+            }
+        } catch( const IPC::QueueEOF& e ) {
+        }
+    } );
+}
+
+static void _bench_mqueue( size_t n, size_t capacity ) {
+    Resource<IPC::MQueue<Match>, string> res{ MQUEUE_NAME, capacity };
+
+    /* the message queue has no EOF, so the reader counts the elements */
+    _run( "mqueue", n, [n](){
+        IPC::MQueue<Match> out{ MQUEUE_NAME, IPC::QueueMode::write };
+        for( size_t i = 0; i < n; i++ ) {
+            out.insert( Match{}, i % 2 );
+        }
+    }, [n](){
+        IPC::MQueue<Match> in{ MQUEUE_NAME, IPC::QueueMode::read };
+        for( size_t i = 0; i < n; i++ ) {
+            in.remove();
+        }
+    } );
+}
+
+
+/**
+ * Compares the throughput of the queue implementations moving matches between two processes.
+ * Meant to be built with \c make \c release: the debug build is not optimized and profiles every
+ * call, which slows down the ring (all its work is in user space) but not the FIFO (in the kernel).
+ *
+ * Options:
+ *  --messages <n>          number of matches sent through each queue (default 100000).
+ *  --mqueue-capacity <n>   capacity of the message queue (default 10, the limit for unprivileged users).
+ */
+int main( int argc, const char *argv[] ) {
+    int rv = 0;
+
+    try {
+        ArgParser p{ argc, argv };
+
+        auto n = p.get_optional( "--messages", 100000, size_t );
+        auto capacity = p.get_optional( "--mqueue-capacity", IPC::MQueue<Match>::DEFAULT_CAPACITY, size_t );
+
+        cout << "sending " << n << " elements of " << sizeof( Match ) << " bytes" << endl;
+
+        _bench_fifo( n );
+        _bench_fifo_batched( n );
+        _bench_ring( n );
+        _bench_ring_batched( n );
+        _bench_mqueue( n, capacity );
+
+    } catch( const ArgParser::Error& e ) {
+        cout << e.what() << endl;
+        rv = 1;
+    } catch( const IPC::Process::Exit& e ) {
+        /* does nothing */
+    } catch( const IPC::Error& e ) {
+        LOG << "IPC error: " << e.what() << endl;
+        rv = 3;
+    }
+
+    return rv;
+}
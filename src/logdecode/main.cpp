@@ -0,0 +1,85 @@
+/* include area */
+#include "argparser.hpp"
+#include "bin_log.hpp"
+#include <iomanip>
+#include <iostream>
+#include <string>
+
+using std::cout;
+using std::endl;
+using std::string;
+
+
+/**
+ * Quotes a CSV field (the quotes in it are doubled).
+ */
+static string _csv_quote( const string& field ) {
+    string quoted = "\"";
+    for( char c: field ) {
+        quoted += c;
+        if( c == '"' ) {
+            quoted += '"';
+        }
+    }
+    return quoted + "\"";
+}
+
+/**
+ * Prints each event as a line of text: the time since the first event, the PID, the call site and
+ * the message.
+ */
+static void _print_text( const BinLogReader& log ) {
+    uint64_t start = log.events.empty() ? 0 : log.events.front().timestamp;
+
+    for( const BinLogReader::Event& e: log.events ) {
+        const BinLogReader::Site* site = log.site( e );
+        cout << std::fixed << std::setprecision( 6 ) << std::setw( 12 ) << ( e.timestamp - start ) / 1e9
+             << " (" << e.pid << ") ";
+        if( site != nullptr ) {
+            cout << site->file << ":" << site->line << " ";
+        }
+        cout << log.format( e ) << "\n";
+    }
+}
+
+/**
+ * Prints the events as CSV: timestamp (ns), PID, site ID, file, line and message.
+ */
+static void _print_csv( const BinLogReader& log ) {
+    cout << "timestamp,pid,site,file,line,message" << "\n";
+
+    for( const BinLogReader::Event& e: log.events ) {
+        const BinLogReader::Site* site = log.site( e );
+        cout << e.timestamp << "," << e.pid << "," << e.site << ","
+             << _csv_quote( site ? site->file : "" ) << "," << ( site ? site->line : 0 ) << ","
+             << _csv_quote( log.format( e ) ) << "\n";
+    }
+}
+
+
+int main( int argc, const char *argv[] ) {
+    int rv = 0;
+
+    try {
+        ArgParser p{ argc, argv };
+        auto input = p.get_optional( "--in", BIN_LOG_FILE, string );
+        bool csv = p.is_present( "--csv" );
+
+        BinLogReader log{ input };
+        if( csv ) {
+            _print_csv( log );
+        } else {
+            _print_text( log );
+        }
+        cout.flush();
+
+    } catch( const ArgParser::Error& e ) {
+        cout << argv[0] << " " << e.what() << endl;
+        rv = 1;
+    } catch( const IPC::Error& e ) {
+        cout << "error: " << e.what() << endl;
+        rv = 2;
+    }
+
+    return rv;
+}
@@ -1,16 +1,25 @@
 #include "argparser.hpp"
 #include "barrier.hpp"
+#include "bin_log.hpp"
 #include "queue.hpp"
 #include "ipc.hpp"
+#include "journal.hpp"
 #include "log.hpp"
+#include "log_ring.hpp"
 #include "match.hpp"
+#include "matchmaker.hpp"
 #include "player.hpp"
 #include "process.hpp"
+#include "ring_queue.hpp"
+#include "semaphore.hpp"
 #include "shared_mem.hpp"
 #include "sigint_handler.hpp"
 #include "utils.hpp"
+#include <algorithm>
 #include <errno.h>
 #include <iostream>
+#include <memory>
+#include <signal.h>
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -24,19 +33,29 @@ using std::size_t;
 using std::endl;
 using std::vector;
 using IPC::Resource;
-using IPC::Barrier;
+using IPC::BarrierSet;
 using IPC::Process;
 
 
-/** The filename of the IPC queue where the teams for a match are sent to play. */
+/** The filename of the IPC queues where the teams for a match are sent to play (one per row). */
 static const string MATCH_QUEUE = "/tmp/match_in";
 
 /** The filename of the IPC queue where the results of a match are sent to. */
 static const string RESULTS_QUEUE = "/tmp/match_out";
 
+/** Files where the matches sent and the results processed are journaled. */
+static const string MATCH_JOURNAL = "/tmp/match_in.journal";
+static const string RESULTS_JOURNAL = "/tmp/match_out.journal";
+
 /** Name of the barrier */
 static const string MATCH_BARRIER = "/tmp/match_barrier";
 
+/** Maximum number of matches sent to the courts at once (a pass fills up to that many courts). */
+static const size_t MATCHES_BATCH = 256;
+
+/** Matches held by the queue of a row when it's a ring (a row never has more than a batch). */
+static const size_t RING_CAPACITY = MATCHES_BATCH;
+
 /** Shared memory where the players table is kept. */
 static const string PLAYERS_TABLE = "/dev/null";
 
@@ -74,75 +93,276 @@ static void _start_results_processor( int arg, const char *const argv[] ) {
 }
 
 
-static Team find_team( PlayersTable& players ) {
-    for( PlayerRO p1: players ) {
-        /* has already played the maximum allowed of matches */
-        if( p1.num_matches() >= players.max_matches || p1.get_state() != PlayerState::idle ) {
-            continue;
+/**
+ * Chooses the row where a match is sent: the dry row with more free courts or, if the courts that
+ * are free are all in flooded rows, the flooded row with more free courts.
+ *
+ * \param dry  Tells which rows are not flooded.
+ * \param free_courts Number of free courts (credits) in each row.
+ * \return The row chosen.
+ */
+static size_t _choose_row( const vector<bool>& dry, const vector<size_t>& free_courts ) {
+    size_t best = 0;
+    for( size_t row = 1; row < free_courts.size(); row++ ) {
+        bool usable = ( free_courts[row] > 0 ), best_usable = ( free_courts[best] > 0 );
+        if( usable != best_usable ) {
+            if( usable ) {
+                best = row;
+            }
+        } else if( ( dry[row] && !dry[best] ) || ( dry[row] == dry[best] && free_courts[row] > free_courts[best] ) ) {
+            best = row;
         }
+    }
+    return best;
+}
 
-        /* finds another player */
-        for( PlayerRO p2: players ) {
-            if( p2 == p1 || p2.get_state() != PlayerState::idle || p1.has_played_with( p2 ) ) {
-                continue;
-            }
-            
-            /* gets mutable instances to change the state */
-            Player mp1 = players.get_player( p1.id );
-            Player mp2 = players.get_player( p2.id );
-            mp1.set_state( PlayerState::playing );
-            mp2.set_state( PlayerState::playing );
-            
-            return Team{ p1.id, p2.id };
+
+/**
+ * Takes the credits granted by the free courts (at least one, blocking until a court is free).
+ *
+ * \param credits Credits semaphore.
+ * \param max     Maximum number of credits to take.
+ * \return Number of credits taken (0 if interrupted).
+ */
+static size_t _take_credits( IPC::Semaphore& credits, size_t max ) {
+    if( !credits.wait( CREDITS_TOTAL ) ) {
+        return 0;
+    }
+
+    /* takes the credits of the other free courts without blocking */
+    size_t extra = std::min<size_t>( credits.values()[CREDITS_TOTAL], max - 1 );
+    if( extra > 0 && credits.try_wait( CREDITS_TOTAL, extra ) ) {
+        return 1 + extra;
+    }
+    return 1;
+}
+
+
+/**
+ * Tells if some player is playing a match (neither available nor done with all the matches).
+ */
+static bool _playing( PlayersTable& players ) {
+    return players.available() + players.exhausted() < players.size();
+}
+
+/**
+ * Sends the matches to the queue of a row, retrying when the write is cut short (unless the
+ * process has to quit).
+ *
+ * \return Number of matches sent (the first ones of \a matches).
+ */
+template <class MatchQueue> static size_t _send_matches( MatchQueue& queue, const vector<Match>& matches, SIGINT_Handler& eh ) {
+    size_t sent = 0;
+    while( sent < matches.size() ) {
+        try {
+            sent += queue.insert_many( matches.data() + sent, matches.size() - sent );
+        } catch( const IPC::QueueError& e ) {
+            LOG << "matches not sent: " << e.what() << endl;
+            break;
+        }
+
+        if( eh.has_to_quit() ) {
+            break;
+        }
+    }
+    return sent;
+}
+
+/**
+ * Moves the players of matches that were claimed but not played back to idle.
+ */
+static void _release_matches( PlayersTable& players, vector<Match>::const_iterator first, vector<Match>::const_iterator last ) {
+    for( ; first != last; ++first ) {
+        for( player_t id: { first->team1.player1, first->team1.player2, first->team2.player1, first->team2.player2 } ) {
+            players.get_player( id ).set_state( PlayerState::idle );
         }
     }
-    
-    // TODO: use another exception type
-    throw IPC::Error( "No pairs found" );
 }
 
 
 /**
  * Producer of voley matches.
+ * Matches are only formed when a court is free (a court grants a credit when it's ready to play),
+ * so the players are not marked as playing while their match waits for a court.
+ * Each match is sent to the queue of a row with free courts, preferring the rows that are not
+ * flooded. If \a journal is not null, the matches sent are appended to it.
+ * The queues of the rows are of type \a MatchQueue (FIFOs or rings).
+ *
+ * \return \c true if the tournament was finished (no more matches could be formed) when quitting.
  */
-static void _produce_matches( PlayersTable& players,
-                              const string& consumer_name,
-                              SIGINT_Handler& eh ) {
-    IPC::Queue<Match> consumer{ consumer_name, IPC::QueueMode::write };
+template <class MatchQueue> static bool _produce_matches( PlayersTable& players,
+                                                          int rows,
+                                                          const string& consumer_name,
+                                                          const string& ipc_name,
+                                                          IPC::Journal<Match>* journal,
+                                                          SIGINT_Handler& eh ) {
+    vector<MatchQueue> consumers;
+    for( int row = 0; row < rows; row++ ) {
+        consumers.push_back( MatchQueue{ row_queue( consumer_name, row ), IPC::QueueMode::write } );
+    }
+    BarrierSet tides{ IPC::Key{ ipc_name, TIDES_KEY_ID } };
+    IPC::Semaphore credits{ IPC::Key{ ipc_name, CREDITS_KEY_ID } };
+
+    Matchmaker matchmaker{ players };
+    vector<Match> batch;
+    vector<vector<Match>> routed( rows );
+    vector<bool> dry( rows );
+    vector<size_t> free_courts( rows );
+    vector<short> taken( rows + 1 );
 
     LOG_DBG << "start producing matches" << endl;
 
+    bool finished = false, journal_full = false;
     while( !eh.has_to_quit() ) {
+        size_t available = _take_credits( credits, MATCHES_BATCH );
+        if( available == 0 ) {
+            continue;
+        }
+
+        uint32_t changes = players.changes();
+        matchmaker.find_matches( batch, available );
+
+        /* gives back the credits that were not used */
+        if( batch.size() < available ) {
+            credits.post( { CREDITS_TOTAL }, available - batch.size() );
+        }
+
+        if( batch.empty() ) {
+            /* no match is being played and the players left can't form one: no more matches will
+               be formed (unless more players join) */
+            bool done = !_playing( players ) && !matchmaker.can_form_match();
+            if( done && !finished ) {
+                LOG << "tournament finished" << endl;
+            }
+            finished = done;
+
+            /* nobody free right now: waits until a player is available again */
+            players.wait_changes( changes, std::chrono::milliseconds( 1000 ) );
+            continue;
+        }
+
+        finished = false;
         try {
-            Match m;
-            m.team1 = find_team( players );
-            m.team2 = find_team( players );
-    
-            consumer.insert( m );
+            /* takes the credits of the rows for the whole batch. A court that leaves or is flooded
+               takes its credit back, so the rows are read again if they don't have them anymore */
+            size_t routed_matches;
+            do {
+                vector<unsigned short> values = credits.values();
+                for( int row = 0; row < rows; row++ ) {
+                    dry[row] = ( tides.value( row ) == 0 );
+                    free_courts[row] = values[row_credits( row )];
+                    taken[row_credits( row )] = 0;
+                    routed[row].clear();
+                }
+
+                routed_matches = 0;
+                for( const Match& m: batch ) {
+                    size_t row = _choose_row( dry, free_courts );
+                    if( free_courts[row] == 0 ) {
+                        break;
+                    }
+                    routed[row].push_back( m );
+                    free_courts[row] -= 1;
+                    taken[row_credits( row )] += 1;
+                    routed_matches++;
+                }
+            } while( !credits.try_wait( taken ) );
+
+            /* the credits left in the total were of courts that are gone: the matches are dropped */
+            if( routed_matches < batch.size() ) {
+                LOG_DBG << batch.size() - routed_matches << " matches without a court" << endl;
+                _release_matches( players, batch.begin() + routed_matches, batch.end() );
+            }
+
+            /* only the matches that reached a court are journaled */
+            batch.clear();
+            for( int row = 0; row < rows; row++ ) {
+                if( routed[row].empty() ) {
+                    continue;
+                }
+
+                for( const Match& m: routed[row] ) {
+                    LOG_BIN( "match {} {} vs {} {} sent to row {}", m.team1.player1, m.team1.player2, m.team2.player1, m.team2.player2, row );
+                }
+                size_t sent = _send_matches( consumers[row], routed[row], eh );
+                batch.insert( batch.end(), routed[row].begin(), routed[row].begin() + sent );
+
+                /* the players of the matches that were not sent are free again, and so are the courts */
+                if( sent < routed[row].size() ) {
+                    _release_matches( players, routed[row].begin() + sent, routed[row].end() );
+                    credits.post( { CREDITS_TOTAL, row_credits( row ) }, routed[row].size() - sent );
+                }
+                routed[row].clear();
+            }
+
+            if( journal != nullptr && !journal->append( batch.data(), batch.size() ) && !journal_full ) {
+                LOG << "matches journal is full" << endl;
+                journal_full = true;
+            }
         } catch( const IPC::Error& e ) {
-            // TODO: REMOVE!!!
             LOG << e.what() << endl;
-            sleep( 1 );
         }
     }
+
+    for( int row = 0; row < rows; row++ ) {
+        LOG << "row " << row << " queue: " << consumers[row].stats() << endl;
+    }
+    return finished;
 }
 
 
 static void _players_spawner( PlayersTable& players ) {
-    for( size_t i = 0; i < 10; i++ ) {
+    /* the players recovered from the journals are already in the table */
+    while( players.size() < 10 ) {
         players.add_player();
     }
 }
 
 
+/**
+ * Rebuilds the players table from the journals of a previous run (in a single pass over each one).
+ * The pairs of the matches played are restored. The players of the matches that were sent but
+ * had no result are left idle, so they are matched again.
+ *
+ * \param players         The players table (empty).
+ * \param matches_journal Matches sent in the previous run.
+ * \param results_journal Results processed in the previous run.
+ */
+static void _recover( PlayersTable& players, const IPC::Journal<Match>& matches_journal, const IPC::Journal<MatchResult>& results_journal ) {
+    auto add_players = [&players]( const Match& m ) {
+        player_t max_id = std::max( { m.team1.player1, m.team1.player2, m.team2.player1, m.team2.player2 } );
+        while( players.size() < max_id ) {
+            players.add_player();
+        }
+    };
+
+    size_t sent = matches_journal.replay( add_players );
+
+    size_t played = 0;
+    size_t processed = results_journal.replay( [&]( const MatchResult& res ) {
+        add_players( res.match );
+        if( res.status != Status::played ) {
+            return;
+        }
+
+        Player p1_1 = players.get_player( res.match.team1.player1 );
+        Player p2_1 = players.get_player( res.match.team1.player2 );
+        p1_1.set_pair( p2_1 );
+
+        Player p1_2 = players.get_player( res.match.team2.player1 );
+        Player p2_2 = players.get_player( res.match.team2.player2 );
+        p1_2.set_pair( p2_2 );
+        played++;
+    } );
+
+    LOG << "recovered " << players.size() << " players and " << played << " matches played ("
+        << ( sent > processed ? sent - processed : 0 ) << " matches were lost)" << endl;
+}
+
+
 static void _start_tides( int rows, const string& filename, SIGINT_Handler *eh ) {
     int tide = 0;
-    vector<Barrier> tides_barriers;
-
-    /* gets the barrier objects */
-    for( int c = 32; c < 32 + rows; c++ ) {
-        tides_barriers.push_back( Barrier{ IPC::Key{ filename, ( char )c } } );
-    }
+    BarrierSet tides_barriers{ IPC::Key{ filename, TIDES_KEY_ID } };
 
     /* increases/descreses the tide randomly */
     while( !eh->has_to_quit() ) {
@@ -166,13 +386,13 @@ static void _start_tides( int rows, const string& filename, SIGINT_Handler *eh )
             /* makes the court processes wait until the tide goes down */
             
             LOG << "~~~~~~~~ tide up ~~~~~~~~" << endl;
-            tides_barriers[tide].set( 1 );
+            tides_barriers.set( tide, 1 );
             tide += 1;
         } else {
             tide -= 1;
             
             /* let's the processes continue */
-            tides_barriers[tide].signal();
+            tides_barriers.signal( tide );
             LOG << "~~~~~~~ tide down ~~~~~~~" << endl;
         }
 
@@ -180,6 +400,45 @@ static void _start_tides( int rows, const string& filename, SIGINT_Handler *eh )
 }
 
 
+/**
+ * Writes the messages of the processes until they all finish (or the parent dies).
+ */
+static void _collect_logs( pid_t parent, SIGINT_Handler& eh ) {
+    IPC::LogRings rings{ LOG_RINGS };
+    Log::get_instance().collect( [&]() {
+        return getppid() != parent || ( eh.has_to_quit() && rings.writers( getpid(), parent ) == 0 );
+    } );
+}
+
+
+/**
+ * Stops the log collector when \c main leaves, also when it unwinds after an error (the collector
+ * only exits by itself on SIGINT or when \c main dies, and destroying it waits for it).
+ * \c main stops using its ring first, so its last messages are written directly.
+ */
+class _CollectorStop {
+public:
+    _CollectorStop( Process& collector ) : collector(collector) {}
+    ~_CollectorStop() { this->stop(); }
+
+    void stop() {
+        if( this->stopped ) {
+            return;
+        }
+        this->stopped = true;
+
+        Log::get_instance().drop_rings();
+        if( this->collector.get_pid() > 0 ) {
+            kill( this->collector.get_pid(), SIGINT );
+        }
+    }
+
+private:
+    Process& collector;
+    bool stopped{ false };
+};
+
+
 int main( int argc, const char *argv[] )
 {
     int rv = 0;
@@ -190,6 +449,9 @@ int main( int argc, const char *argv[] )
         auto max_players = p.get_option( "--max-players", size_t );
         auto max_matches = p.get_option( "--max-matches", size_t );
         int rows = p.get_option( "--rows", int );
+        bool recover = p.is_present( "--recover" );
+        bool journaling = recover || p.is_present( "--journal" );
+        bool ring_queues = p.is_present( "--ring-queues" );
         //auto cols = p.get_option( "--cols", size_t );
         size_t verbosity = p.count( "-v" );
         
@@ -200,26 +462,69 @@ int main( int argc, const char *argv[] )
             Log::get_instance().set_level( Log::Level::debug );
         }
 
+        /* the matches and results are logged in binary (the other processes append to the file) */
+        if( p.is_present( "--binary-log" ) ) {
+            BinLog::get_instance().open( BIN_LOG_FILE, true );
+        }
+
         LOG_DBG << "begin" << endl;
         
         /* signal handlers */
         SIGINT_Handler eh;
         SignalHandler::get_instance()->add_handler( SIGINT, &eh );
         SignalHandler::get_instance()->add_handler( SIGPIPE, &eh );
+
+        /* the processes log to their rings and a single process writes the messages out */
+        std::unique_ptr<Resource<IPC::LogRings, string>> log_res;
+        Process collector;
+        if( verbosity >= 1 ) {
+            log_res.reset( new Resource<IPC::LogRings, string>{ LOG_RINGS } );
+            Log::get_instance().use_rings( LOG_RINGS );
+
+            pid_t parent = getpid();
+            collector = Process{ [&eh, parent](){ _collect_logs( parent, eh ); } };
+        }
+        _CollectorStop collector_stop{ collector };
         
         /* creates the IPC resources */
-        Resource<IPC::Queue<Match>, string> match_q{ MATCH_QUEUE };
+        vector<Resource<IPC::Queue<Match>, string>> match_qs;
+        vector<Resource<IPC::RingQueue<Match>, string>> match_rings;
         Resource<IPC::Queue<MatchResult>, string> result_q{ RESULTS_QUEUE };
-        Resource<PlayersTable> players_res{ argv[0], max_players * 2, max_matches };
-        vector<Resource<Barrier>> tides_barriers;
-
-        /* creates a barrier for each row */
-        for( int c = 32; c < 32 + rows; c++ ) {
-            tides_barriers.push_back( Resource<Barrier>{ IPC::Key{ argv[0], (char)c }, 0 } );
+        Resource<PlayersTable> players_res{ argv[0], max_matches };
+        Resource<BarrierSet> tides_res{ IPC::Key{ argv[0], TIDES_KEY_ID }, ( size_t )rows };
+        Resource<IPC::Semaphore> credits_res{ IPC::Key{ argv[0], CREDITS_KEY_ID }, ( size_t )rows + 1 };
+
+        /* creates a matches queue for each row (a FIFO or, with --ring-queues, a ring in shared memory) */
+        for( int row = 0; row < rows; row++ ) {
+            if( ring_queues ) {
+                match_rings.push_back( Resource<IPC::RingQueue<Match>, string>{ row_queue( MATCH_QUEUE, row ), RING_CAPACITY } );
+            } else {
+                match_qs.push_back( Resource<IPC::Queue<Match>, string>{ row_queue( MATCH_QUEUE, row ) } );
+            }
         }
 
-        /* the table has space for 2*M players */
-        PlayersTable players{ argv[0], max_players * 2, max_matches };
+        /* the table grows as players are added */
+        PlayersTable players{ argv[0] };
+
+        /* the journals are not resources: they are kept when any process dies (or the tournament
+           is interrupted), so the next run can recover, and removed only after a complete run */
+        std::unique_ptr<IPC::Journal<Match>> matches_journal;
+        std::unique_ptr<IPC::Journal<MatchResult>> results_journal;
+        if( journaling ) {
+            size_t capacity = max_players * max_matches;
+            IPC::Journal<Match>::Create( MATCH_JOURNAL, capacity );
+            IPC::Journal<MatchResult>::Create( RESULTS_JOURNAL, capacity );
+            matches_journal.reset( new IPC::Journal<Match>{ MATCH_JOURNAL } );
+            results_journal.reset( new IPC::Journal<MatchResult>{ RESULTS_JOURNAL } );
+
+            if( recover ) {
+                _recover( players, *matches_journal, *results_journal );
+            } else {
+                /* a new tournament */
+                matches_journal->reset();
+                results_journal->reset();
+            }
+        }
 
         // TODO: include the IO Queue names
         _players_spawner( players );
@@ -228,13 +533,29 @@ int main( int argc, const char *argv[] )
 
         Process tides_proc{ [rows, argv, &eh](){ _start_tides( rows, argv[0], &eh ); } };
 
-        _produce_matches( players, MATCH_QUEUE, eh );
+        bool finished;
+        if( ring_queues ) {
+            finished = _produce_matches<IPC::RingQueue<Match>>( players, rows, MATCH_QUEUE, argv[0], matches_journal.get(), eh );
+        } else {
+            finished = _produce_matches<IPC::Queue<Match>>( players, rows, MATCH_QUEUE, argv[0], matches_journal.get(), eh );
+        }
+
+        /* the collector exits along with the other processes */
+        collector_stop.stop();
 
         // TODO: do better
         do {
             int status;
             wait( &status );
         } while( errno != ECHILD );
+
+        /* a complete tournament has nothing to recover (no matches left and none being played) */
+        if( journaling && finished && !_playing( players ) ) {
+            matches_journal.reset();
+            results_journal.reset();
+            IPC::Journal<Match>::Destroy( MATCH_JOURNAL );
+            IPC::Journal<MatchResult>::Destroy( RESULTS_JOURNAL );
+        }
         
     } catch( const ArgParser::Error& e ) {
         std::cout << e.what() << endl;
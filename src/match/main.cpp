@@ -7,8 +7,11 @@
 #include "log.hpp"
 #include "match.hpp"
 #include "process.hpp"
+#include "ring_queue.hpp"
+#include "semaphore.hpp"
 #include "sigint_handler.hpp"
 #include "utils.hpp"
+#include <chrono>
 #include <iostream>
 #include <unistd.h>
 #include <vector>
@@ -18,10 +21,13 @@ using std::size_t;
 using std::string;
 using std::endl;
 
-/* IO FIFOs */
+/* IO queues (the input has one queue per row, a FIFO or a ring) */
 static const string INPUT = "/tmp/match_in";
 static const string OUTPUT = "/tmp/match_out";
 
+/** Maximum time a court waits for a match before checking if it has to quit. */
+static const std::chrono::milliseconds MATCH_TIMEOUT{ 500 };
+
 
 /**
  * Returns a random (but valid) result of a voley match.
@@ -50,6 +56,7 @@ static std::pair<int, int> _rand_result() {
             break;
         /* team 2 won 3:2 */
         case 4:
+        default:
             team1_sets = 2;
             team2_sets = 3;
             break;
@@ -59,31 +66,85 @@ static std::pair<int, int> _rand_result() {
 }
 
 
+/**
+ * Time a court spends playing, reported when the court leaves.
+ */
+struct _CourtUsage {
+    _CourtUsage( int row ) : row(row) {}
+    ~_CourtUsage() {
+        double total = std::chrono::duration<double>( std::chrono::steady_clock::now() - this->start ).count();
+        double busy = std::chrono::duration<double>( this->busy ).count();
+        LOG << "court in row " << this->row << " played " << this->matches << " matches, busy "
+            << static_cast<int>( total > 0 ? 100 * busy / total : 0 ) << "% of " << static_cast<int>( total ) << " seconds" << endl;
+    }
+
+    int row;
+    size_t matches{ 0 };
+    std::chrono::steady_clock::time_point start{ std::chrono::steady_clock::now() };
+    std::chrono::steady_clock::duration busy{ 0 };
+};
+
+
 /**
  * Reads from the input queue and simulates voley matches using the players
  * read from the queue.
+ * The credit of the court is posted with undo, so the system takes it back if the court exits
+ * (or crashes) while it's free. It's kept once a match is received, and taken back while the row
+ * is flooded, so no match waits for a court that can't play it.
  * 
  * \param row The row of the queue.
  * \param eh Event handler for the received signals.
- * \param input Name of the input Queue.
+ * \param input Name of the input Queue (each row reads from its own queue, of type \a MatchQueue).
  * \param output Name of the output Queue.
  */
-void _consume_matches( int row, SIGINT_Handler& eh, const string& input, const string& output ) {
-    IPC::Queue<Match> in( input, IPC::QueueMode::read, true );
+template <class MatchQueue> void _consume_matches( int row, SIGINT_Handler& eh, const string& input, const string& output ) {
+    MatchQueue in( row_queue( input, row ), IPC::QueueMode::read, true );
     IPC::Queue<MatchResult> out( output, IPC::QueueMode::write, true );
 
-    /* gets the barrier that corresponds to this row */
-    IPC::Barrier tide{ IPC::Key{ "./target/main", ( char )( 32 + row ) } };  // TODO: filename!
+    /* gets the tides (one barrier for each row) */
+    IPC::BarrierSet tides{ IPC::Key{ "./target/main", TIDES_KEY_ID } };  // TODO: filename!
+    IPC::Semaphore credits{ IPC::Key{ "./target/main", CREDITS_KEY_ID }, true };
+    bool granted = false;
+
+    /* the credit of the court */
+    std::vector<short> credit( row_credits( row ) + 1, 0 );
+    credit[CREDITS_TOTAL] = 1;
+    credit[row_credits( row )] = 1;
+
+    _CourtUsage usage{ row };
 
     while( !eh.has_to_quit() ) {
         try {
-            tide.wait();
+            /* a flooded court takes its credit back (unless the producer took it: its match is
+               played once the tide goes down) */
+            if( granted && tides.value( row ) != 0 && credits.try_wait( credit ) ) {
+                granted = false;
+            }
+            tides.wait( row );
+
+            /* lets the producer know that this court is free (only once per match) */
+            if( !granted ) {
+                credits.post( { CREDITS_TOTAL, row_credits( row ) } );
+                granted = true;
+            }
             
-            Match m = in.remove();
+            Match m;
+            if( !in.remove_for( m, MATCH_TIMEOUT ) ) {
+                /* if the queue was closed, exits */
+                if( in.eof() ) {
+                    return;
+                }
+                continue;
+            }
+            credits.keep( { CREDITS_TOTAL, row_credits( row ) } );
+            granted = false;
 
+            auto start = std::chrono::steady_clock::now();
             int match_duration = Utils::rand_int( 3, 6 );
             LOG << "Match: " << m << " in row " << row << " taking " << match_duration << " seconds" << endl;
             unsigned int sleep_rv = sleep( match_duration );
+            usage.busy += std::chrono::steady_clock::now() - start;
+            usage.matches++;
 
             MatchResult r;
             r.match = m;
@@ -102,9 +163,12 @@ void _consume_matches( int row, SIGINT_Handler& eh, const string& input, const s
             out.insert( r );
         } catch( IPC::QueueError& e ) {
             LOG << "Queue error: " << e.what() << endl;
-        } catch( IPC::Barrier::Error& e ) {
+        } catch( IPC::BarrierSet::Error& e ) {
             LOG << "Barrier error: " << e.what() << endl;
             return;
+        } catch( IPC::Semaphore::Error& e ) {
+            LOG << "Semaphore error: " << e.what() << endl;
+            return;
         } catch ( IPC::QueueEOF& e ) {
             /* if the queue was closed, exits */
             return;
@@ -120,12 +184,14 @@ void _consume_matches( int row, SIGINT_Handler& eh, const string& input, const s
  * \param ncols Number of columns.
  * \param input The name of the input Queue.
  * \param input The name of the output Queue.
+ * \param ring_queues Tells if the input queues are rings instead of FIFOs.
  * \param eh Events handler.
  */
 void _create_courts( int nrows,
                      int ncols,
                      const string& input,
                      const string& output,
+                     bool ring_queues,
                      SIGINT_Handler& eh ) {
     /* stores the sub processes in a vector so they are destroyed when this function exits */
     std::vector<IPC::Process> childs;
@@ -133,7 +199,8 @@ void _create_courts( int nrows,
     /* creates a pool of sub-processes, one for each court */
     for( int i = 0; i < nrows; i++ ) {
         for( int j = 0; j < ncols; j++ ) {
-            auto callback = std::bind( _consume_matches, i, eh, input, output );
+            auto consume = ( ring_queues ? _consume_matches<IPC::RingQueue<Match>> : _consume_matches<IPC::Queue<Match>> );
+            auto callback = std::bind( consume, i, std::ref( eh ), input, output );
             childs.push_back( IPC::Process{ callback } );
         }
     }
@@ -151,10 +218,12 @@ int main( int argc, const char *argv[] ) {
         auto ncols = p.get_option( "--cols", int );
         auto input = p.get_optional( "--in", INPUT, string );
         auto output = p.get_optional( "--out", OUTPUT, string );
+        bool ring_queues = p.is_present( "--ring-queues" );
         
         size_t verbosity = p.count( "-v" );
         if( verbosity >= 1 ) {
             Log::get_instance().add_listener( std::cout );
+            Log::get_instance().use_rings( LOG_RINGS );
         }
         if( verbosity >= 2 ) {
             Log::get_instance().set_level( Log::Level::debug );
@@ -170,7 +239,7 @@ int main( int argc, const char *argv[] ) {
         SignalHandler::get_instance()->add_handler( SIGTERM, &eh );
         
         /* creates the processes for the matches */
-        _create_courts( nrows, ncols, input, output, eh );
+        _create_courts( nrows, ncols, input, output, ring_queues, eh );
 
     } catch( const ArgParser::Error& e ) {
         std::cout << argv[0] << " " << e.what() << endl;
@@ -181,7 +250,7 @@ int main( int argc, const char *argv[] ) {
     } catch( const IPC::QueueEOF& e ) {
         LOG << "Queue EOF" << endl;
         rv = 3;
-    } catch( const IPC::Barrier::Error& e) {
+    } catch( const IPC::BarrierSet::Error& e) {
         LOG << "Barrier error: " << e.what() << endl;
         rv = 4;
     } catch( const IPC::Process::Exit& e ) {
@@ -1,5 +1,6 @@
 /* include area */
 #include "argparser.hpp"
+#include "framed_queue.hpp"
 #include "ipc.hpp"
 #include "log.hpp"
 #include "player.hpp"
@@ -10,12 +11,51 @@ using std::string;
 using std::vector;
 
 
+/** Maximum size of the payload of a message. */
+static const size_t MAX_PAYLOAD = 1024;
+
+/** Queue of messages: each one is the type followed by the bytes of the payload used. */
+typedef IPC::FramedQueue<sizeof( int ) + MAX_PAYLOAD> MessageQueue;
+
 struct Message {
     int type;
-    char payload[1024];
+    char payload[MAX_PAYLOAD];
+
+    /** Number of bytes used in the payload. */
+    size_t length;
 };
 
 
+/**
+ * Sends a message, copying only the bytes used of the payload.
+ */
+static void _send( MessageQueue& queue, const Message& msg ) {
+    struct iovec parts[] = {
+        { const_cast<int *>( &msg.type ), sizeof( msg.type ) },
+        { const_cast<char *>( msg.payload ), msg.length },
+    };
+    queue.insert( parts, 2 );
+}
+
+/**
+ * Receives a message directly into its fields.
+ */
+static Message _receive( MessageQueue& queue ) {
+    Message msg;
+    struct iovec parts[] = {
+        { &msg.type, sizeof( msg.type ) },
+        { msg.payload, MAX_PAYLOAD },
+    };
+    size_t length = queue.remove( parts, 2 );
+    if( length < sizeof( msg.type ) ) {
+        throw IPC::QueueError( "message without type" );
+    }
+
+    msg.length = length - sizeof( msg.type );
+    return msg;
+}
+
+
 int main( int argc, const char *argv[] ) {
     int rv = 0;
 
@@ -33,12 +73,21 @@ int main( int argc, const char *argv[] ) {
 
         vector<Player> players{};
 
-        
+        MessageQueue requests{ input, IPC::QueueMode::read };
+        MessageQueue responses{ output, IPC::QueueMode::write };
+
         /* handles requests */
         while( !eh.has_to_quit() ) {
-            
+            Message msg = _receive( requests );
+            LOG_DBG << "request type " << msg.type << " (" << msg.length << " bytes)" << endl;
+
+            /* no request types are handled yet, the message is acknowledged */
+            msg.length = 0;
+            _send( responses, msg );
         }
         
+    } catch( const IPC::QueueEOF& e ) {
+        /* all the clients left */
     } catch( const IPC::Error& e ) {
         LOG << "IPC error: " << e.what() << endl;
     }
@@ -1,12 +1,17 @@
 /* include area */
 #include "argparser.hpp"
+#include "bin_log.hpp"
 #include "log.hpp"
 #include "ipc.hpp"
+#include "journal.hpp"
 #include "match.hpp"
 #include "process.hpp"
 #include "queue.hpp"
+#include "selector.hpp"
 #include "sigint_handler.hpp"
+#include <chrono>
 #include <map>
+#include <memory>
 #include <set>
 #include <iomanip>
 #include <functional>
@@ -27,9 +32,21 @@ using IPC::Resource;
 /** The name of the queue where the results of the matches are read from. */
 static const string RESULTS_QUEUE = "/tmp/match_out";
 
+/** File where the results processed are journaled (created by the main process). */
+static const string RESULTS_JOURNAL = "/tmp/match_out.journal";
+
 /** Queue to redirect the results. */
 static const string REDIRECT_QUEUE = "/tmp/redirect";
 
+/** Maximum time the scoreboard waits for a result before checking if it has to quit. */
+static const std::chrono::milliseconds SCOREBOARD_TIMEOUT{ 500 };
+
+/** Time between logs of the results queue statistics. */
+static const std::chrono::milliseconds STATS_PERIOD{ 5000 };
+
+/** Maximum number of results read at once. */
+static const size_t RESULTS_BATCH = 64;
+
 /** For 2 teams teamX and teamY, the table gives the points of teamX as sets_to_points[teamY.sets][teamX.sets] */
 static const int sets_to_points[][4] = {
     { -1, -1, -1,  3 },
@@ -39,12 +56,53 @@ static const int sets_to_points[][4] = {
 };
 
 
+/**
+ * Updates the players table with the result of a match and sends it to the scoreboard.
+ *
+ * \param players    The players table.
+ * \param redirect_q Queue where the results of the played matches are redirected.
+ * \param res        Result of the match.
+ */
+static void _process_result( PlayersTable& players, IPC::Queue<MatchResult>& redirect_q, const MatchResult& res ) {
+    LOG << "result: " << res << endl;
+    LOG_BIN( "result {} {} vs {} {} = ({}, {}) status {}", res.match.team1.player1, res.match.team1.player2,
+             res.match.team2.player1, res.match.team2.player2, res.team1_sets, res.team2_sets, res.status );
+
+    Player p1_1 = players.get_player( res.match.team1.player1 );
+    Player p2_1 = players.get_player( res.match.team1.player2 );
+    Player p1_2 = players.get_player( res.match.team2.player1 );
+    Player p2_2 = players.get_player( res.match.team2.player2 );
+
+    /* the pairs are set first, so the players that played all their matches never get idle
+     * with matches left */
+    if( res.status == Status::played ) {
+        p1_1.set_pair( p2_1 );
+        p1_2.set_pair( p2_2 );
+    }
+
+    p1_1.set_state( PlayerState::idle );
+    p2_1.set_state( PlayerState::idle );
+    p1_2.set_state( PlayerState::idle );
+    p2_2.set_state( PlayerState::idle );
+
+    if( res.status == Status::played ) {
+        redirect_q.insert( res );
+    }
+}
+
+
 static void _scoreboard( SIGINT_Handler* eh ) {
     IPC::Queue<MatchResult> input{ REDIRECT_QUEUE, IPC::QueueMode::read };
 
     map<player_t, int> scores;
     while( !eh->has_to_quit() ) {
-        MatchResult res = input.remove();
+        MatchResult res;
+        if( !input.remove_for( res, SCOREBOARD_TIMEOUT ) ) {
+            if( input.eof() ) {
+                return;
+            }
+            continue;
+        }
 
         int team1_points = sets_to_points[res.team2_sets][res.team1_sets];
         int team2_points = sets_to_points[res.team1_sets][res.team2_sets];
@@ -71,7 +129,7 @@ static void _scoreboard( SIGINT_Handler* eh ) {
         }
 
         /* displays the scores */
-        /* gets the logger object to hols the lock while printing the table */
+        /* keeps the log stream object so the whole ranking is sent as a single record */
         LogStream logger = Log::get_instance() << endl
            << "+---- RANKING ----+" << endl
            << "| player | score  |" << endl
@@ -91,16 +149,17 @@ int main( int argc, const char *argv[] ) {
         
         ArgParser p{ argc, argv };
         
-        auto max_players = p.get_option( "--max-players", size_t );
-        auto max_matches = p.get_option( "--max-matches", size_t );
-        
         size_t verbosity = p.count( "-v" );
         if( verbosity >= 1 ) {
             Log::get_instance().add_listener( std::cout );
+            Log::get_instance().use_rings( LOG_RINGS );
         }
         if( verbosity >= 2 ) {
             Log::get_instance().set_level( Log::Level::debug );
         }
+        if( p.is_present( "--binary-log" ) ) {
+            BinLog::get_instance().open( BIN_LOG_FILE, false );
+        }
 
         LOG_DBG << "begin" << endl;
         
@@ -121,27 +180,34 @@ int main( int argc, const char *argv[] ) {
         IPC::Queue<MatchResult> results{ RESULTS_QUEUE, IPC::QueueMode::read };
 
         // TODO: filename!!!
-        PlayersTable players{ argv[0], max_players * 2, max_matches };
-
-        while( !eh.has_to_quit() ) {
-            MatchResult res = results.remove();
-            LOG << "result: " << res << endl;
-
-            Player p1_1 = players.get_player( res.match.team1.player1 );
-            Player p2_1 = players.get_player( res.match.team1.player2 );
-            p1_1.set_state( PlayerState::idle );
-            p2_1.set_state( PlayerState::idle );
-
-            Player p1_2 = players.get_player( res.match.team2.player1 );
-            Player p2_2 = players.get_player( res.match.team2.player2 );
-            p1_2.set_state( PlayerState::idle );
-            p2_2.set_state( PlayerState::idle );
-                        
-            if( res.status == Status::played ) {
-                p1_1.set_pair( p2_1 );
-                p1_2.set_pair( p2_2 );
-                redirect_q.insert( res );
+        PlayersTable players{ argv[0] };
+
+        /* the results are journaled after updating the table, so the table can be rebuilt */
+        std::unique_ptr<IPC::Journal<MatchResult>> journal;
+        if( p.is_present( "--journal" ) || p.is_present( "--recover" ) ) {
+            journal.reset( new IPC::Journal<MatchResult>{ RESULTS_JOURNAL } );
+        }
+
+        /* waits for the results (more sources can be registered in the same selector) */
+        IPC::Selector selector;
+        MatchResult batch[RESULTS_BATCH];
+        bool journal_full = false;
+        selector.add( results, [&]() {
+            size_t n = results.remove_many( batch, RESULTS_BATCH );
+            for( size_t i = 0; i < n; i++ ) {
+                _process_result( players, redirect_q, batch[i] );
             }
+            if( journal && !journal->append( batch, n ) && !journal_full ) {
+                LOG << "results journal is full" << endl;
+                journal_full = true;
+            }
+        } );
+        selector.add_timer( STATS_PERIOD, [&results]() {
+            LOG_DBG << "results queue: " << results.stats() << endl;
+        } );
+
+        while( !eh.has_to_quit() && selector.size() > 0 ) {
+            selector.dispatch();
         }
         
     } catch( const IPC::QueueError& e ) {
@@ -1,13 +1,32 @@
 /* include area */
+#include "arena.hpp"
+#include "barrier.hpp"
+#include "bin_log.hpp"
+#include "framed_queue.hpp"
 #include "ipc.hpp"
+#include "journal.hpp"
+#include "log_ring.hpp"
+#include "mapped_mem.hpp"
+#include "matchmaker.hpp"
+#include "mqueue.hpp"
+#include "pair_search.hpp"
 #include "player.hpp"
 #include "process.hpp"
+#include "queue.hpp"
+#include "ring_queue.hpp"
+#include "rw_lock.hpp"
+#include "selector.hpp"
+#include "semaphore.hpp"
 #include "sigint_handler.hpp"
 #include "str_utils.hpp"
 #include "utils.hpp"
+#include <chrono>
 #include <iostream>
 #include <string>
 #include <exception>
+#include <fstream>
+#include <iterator>
+#include <vector>
 
 using std::cout;
 using std::endl;
@@ -60,6 +79,882 @@ static void _play( PlayersTable* players ) {
 }
 
 
+static void _test_ring_queue() {
+    const string filename = "/tmp/cv_test_ring";
+    Resource<IPC::RingQueue<size_t>, string> ring_res{ filename, 4 };
+
+    /* the writer fills the ring many times while the reader consumes */
+    IPC::Process writer{ [&filename](){
+        IPC::RingQueue<size_t> out{ filename, IPC::QueueMode::write };
+        for( size_t i = 0; i < 100; i++ ) {
+            out.insert( i );
+        }
+
+        /* a batch larger than the ring is copied as the reader makes room */
+        std::vector<size_t> elems;
+        for( size_t i = 100; i < 200; i++ ) {
+            elems.push_back( i );
+        }
+        ASSERT( out.insert_many( elems.data(), elems.size() ) == elems.size() );
+    } };
+
+    IPC::RingQueue<size_t> in{ filename, IPC::QueueMode::read };
+    for( size_t i = 0; i < 100; i++ ) {
+        ASSERT( in.remove() == i );
+    }
+
+    size_t buffer[8];
+    size_t expected = 100;
+    while( expected < 200 ) {
+        size_t n = in.remove_many( buffer, 8 );
+        ASSERT( n > 0 && n <= 4 );
+        for( size_t i = 0; i < n; i++ ) {
+            ASSERT( buffer[i] == expected++ );
+        }
+    }
+    ASSERT( in.stats().dequeued.load() == 200 && in.size() == 0 );
+
+    /* the writer left, so the queue reached the end */
+    size_t elem;
+    ASSERT( !in.remove_for( elem, std::chrono::milliseconds( 10 ) ) && in.eof() );
+
+    bool eof = false;
+    try {
+        in.remove();
+    } catch( const IPC::QueueEOF& e ) {
+        eof = true;
+    }
+    ASSERT( eof );
+}
+
+
+static void _test_ring_queue_timeouts() {
+    const string filename = "/tmp/cv_test_ring";
+    Resource<IPC::RingQueue<size_t>, string> ring_res{ filename, 4 };
+
+    IPC::RingQueue<size_t> out{ filename, IPC::QueueMode::write };
+    IPC::RingQueue<size_t> in{ filename, IPC::QueueMode::read };
+
+    /* nothing to read while the writer is connected */
+    size_t elem;
+    auto start = std::chrono::steady_clock::now();
+    ASSERT( !in.try_remove( elem ) );
+    ASSERT( !in.remove_for( elem, std::chrono::milliseconds( 50 ) ) && !in.eof() );
+    ASSERT( std::chrono::steady_clock::now() - start >= std::chrono::milliseconds( 50 ) );
+
+    out.insert( 7 );
+    ASSERT( in.try_remove( elem ) && elem == 7 );
+}
+
+
+static void _test_queue_batches() {
+    const string filename = "/tmp/cv_test_queue";
+    Resource<IPC::Queue<size_t>, string> queue_res{ filename };
+
+    /* inserts more than PIPE_BUF bytes at once */
+    IPC::Process writer{ [&filename](){
+        IPC::Queue<size_t> out{ filename, IPC::QueueMode::write };
+        std::vector<size_t> elems;
+        for( size_t i = 0; i < 2000; i++ ) {
+            elems.push_back( i );
+        }
+        ASSERT( out.insert_many( elems.data(), elems.size() ) == elems.size() );
+    } };
+
+    IPC::Queue<size_t> in{ filename, IPC::QueueMode::read };
+    size_t buffer[300];
+    size_t expected = 0;
+    while( expected < 2000 ) {
+        size_t n = in.remove_many( buffer, 300 );
+        ASSERT( n > 0 && n <= 300 );
+        for( size_t i = 0; i < n; i++ ) {
+            ASSERT( buffer[i] == expected++ );
+        }
+    }
+
+    bool eof = false;
+    try {
+        in.remove_many( buffer, 300 );
+    } catch( const IPC::QueueEOF& e ) {
+        eof = true;
+    }
+    ASSERT( eof );
+
+    /* the statistics are shared with the writer */
+    ASSERT( in.stats().enqueued == 2000 );
+    ASSERT( in.stats().dequeued == 2000 );
+    ASSERT( in.size() == 0 );
+    ASSERT( in.stats().high_water > 0 && in.stats().high_water <= 2000 );
+    ASSERT( in.stats().latency_percentile( 1 ) > 0 );
+
+    /* the FIFO is not left behind if the statistics can't be created */
+    const string stale = "/tmp/cv_test_stale_queue";
+    IPC::MappedMem<IPC::QueueStats>::Create( IPC::QueueStats::Name( stale ), 1, IPC::MapOptions::none );
+    bool failed = false;
+    try {
+        IPC::Queue<size_t>::Create( stale );
+    } catch( const IPC::Error& e ) {
+        failed = true;
+    }
+    IPC::MappedMem<IPC::QueueStats>::Destroy( IPC::QueueStats::Name( stale ) );
+    ASSERT( failed && access( stale.c_str(), F_OK ) != 0 );
+}
+
+
+static void _test_queue_timeouts() {
+    const string filename = "/tmp/cv_test_queue";
+    Resource<IPC::Queue<size_t>, string> queue_res{ filename };
+
+    IPC::Process writer{ [&filename](){
+        IPC::Queue<size_t> out{ filename, IPC::QueueMode::write };
+        out.insert( 7 );
+        usleep( 200000 );
+    } };
+
+    IPC::Queue<size_t> in{ filename, IPC::QueueMode::read };
+    size_t elem = 0;
+    ASSERT( in.remove_for( elem, std::chrono::milliseconds( 5000 ) ) );
+    ASSERT( elem == 7 );
+
+    /* the writer is still connected but there's nothing to read */
+    ASSERT( in.try_remove( elem ) == false );
+    ASSERT( in.eof() == false );
+
+    /* waits until the writer leaves */
+    ASSERT( in.remove_for( elem, std::chrono::milliseconds( 5000 ) ) == false );
+    ASSERT( in.eof() );
+}
+
+
+static void _test_selector() {
+    const string filename = "/tmp/cv_test_queue";
+    Resource<IPC::Queue<size_t>, string> queue_res{ filename };
+
+    IPC::Process writer{ [&filename](){
+        IPC::Queue<size_t> out{ filename, IPC::QueueMode::write };
+        for( size_t i = 0; i < 3; i++ ) {
+            out.insert( i );
+        }
+    } };
+
+    IPC::Queue<size_t> in{ filename, IPC::QueueMode::read };
+    IPC::Selector selector;
+
+    std::vector<size_t> elems;
+    size_t ticks = 0;
+    selector.add_reader<size_t>( in, [&elems]( const size_t& elem ) { elems.push_back( elem ); } );
+    selector.add_timer( std::chrono::milliseconds( 10 ), [&ticks]() { ticks++; } );
+    ASSERT( selector.size() == 2 );
+
+    /* the queue is removed once the writer leaves */
+    while( selector.size() == 2 ) {
+        selector.dispatch();
+    }
+    ASSERT( elems.size() == 3 && elems[0] == 0 && elems[2] == 2 );
+
+    while( ticks == 0 ) {
+        selector.dispatch();
+    }
+}
+
+
+static void _test_semaphore( const char *filename ) {
+    IPC::Key key{ filename, 's' };
+    Resource<IPC::Semaphore> sem_res{ key, 3 };
+    IPC::Semaphore sem{ key };
+
+    sem.post( { 0, 2 } );
+    sem.post( { 0 }, 2 );
+    ASSERT( sem.values() == std::vector<unsigned short>( { 3, 0, 1 } ) );
+
+    /* all or nothing */
+    ASSERT( sem.try_wait( std::vector<short>{ 1, 1, 0 } ) == false );
+    ASSERT( sem.try_wait( std::vector<short>{ 2, 0, 1 } ) );
+    ASSERT( sem.try_wait( 0, 2 ) == false );
+    ASSERT( sem.wait( 0 ) );
+    ASSERT( sem.values() == std::vector<unsigned short>( { 0, 0, 0 } ) );
+
+    /* the changes of a process that exits are undone, except the ones kept */
+    IPC::Process{ [key](){
+        IPC::Semaphore undo{ key, true };
+        undo.post( { 0, 1 }, 2 );
+        undo.keep( { 0 } );
+    } };
+    ASSERT( sem.values() == std::vector<unsigned short>( { 1, 0, 0 } ) );
+}
+
+
+static void _test_mqueue() {
+    const string name = "/cv_test_mqueue";
+    Resource<IPC::MQueue<size_t>, string> mq_res{ name, 4 };
+    IPC::MQueue<size_t> out{ name, IPC::QueueMode::write };
+    IPC::MQueue<size_t> in{ name, IPC::QueueMode::read };
+
+    /* higher priorities are removed first, FIFO within the same priority */
+    out.insert( 1, 0 );
+    out.insert( 2, 5 );
+    out.insert( 3, 0 );
+    out.insert( 4, 5 );
+
+    unsigned int priority;
+    ASSERT( in.remove( &priority ) == 2 && priority == 5 );
+    ASSERT( in.remove() == 4 );
+    ASSERT( in.remove() == 1 );
+    ASSERT( in.remove() == 3 );
+
+    size_t elem;
+    ASSERT( in.try_remove( elem ) == false );
+    ASSERT( in.remove_for( elem, std::chrono::milliseconds( 20 ) ) == false );
+    out.insert( 7 );
+    ASSERT( in.remove_for( elem, std::chrono::milliseconds( 20 ) ) && elem == 7 );
+}
+
+
+static void _test_journal() {
+    const string filename = "/tmp/cv_test.journal";
+    Resource<IPC::Journal<size_t>, string> journal_res{ filename, 100 };
+
+    {
+        IPC::Journal<size_t> journal{ filename, 8 };
+        ASSERT( journal.size() == 0 );
+        for( size_t i = 0; i < 90; i += 3 ) {
+            size_t batch[] = { i, i + 1, i + 2 };
+            ASSERT( journal.append( batch, 3 ) );
+        }
+
+        /* all or nothing when the segment is full */
+        size_t batch[20] = {};
+        ASSERT( journal.append( batch, 20 ) == false );
+        ASSERT( journal.size() == 90 );
+    }
+
+    /* the records are kept when the segment is created again */
+    IPC::Journal<size_t>::Create( filename, 10 );
+    IPC::Journal<size_t> journal{ filename };
+
+    size_t expected = 0;
+    ASSERT( journal.replay( [&expected]( size_t elem ) { ASSERT( elem == expected ); expected++; } ) == 90 );
+
+    journal.reset();
+    ASSERT( journal.replay( []( size_t ) { ASSERT( false ); } ) == 0 );
+}
+
+
+static void _test_framed_queue() {
+    const string filename = "/tmp/cv_test_framed";
+    Resource<IPC::FramedQueue<64>, string> queue_res{ filename };
+
+    IPC::Process writer{ [&filename](){
+        IPC::FramedQueue<64> out{ filename, IPC::QueueMode::write };
+        for( uint32_t i = 0; i < 40; i++ ) {
+            /* a header and a payload of i bytes, sent without copying them together */
+            char payload[64];
+            memset( payload, 'a' + i % 26, i );
+            struct iovec parts[] = { { &i, sizeof( i ) }, { payload, i } };
+            out.insert( parts, 2 );
+        }
+
+        /* more parts than the buffers kept in the stack */
+        char bytes[12] = "abcdefghijk";
+        struct iovec parts[12];
+        for( int i = 0; i < 12; i++ ) {
+            parts[i] = { &bytes[i], 1 };
+        }
+        out.insert( parts, 12 );
+        out.insert( "", 0 );
+    } };
+
+    IPC::FramedQueue<64> in{ filename, IPC::QueueMode::read };
+    for( uint32_t i = 0; i < 40; i++ ) {
+        uint32_t header;
+        char payload[64];
+        struct iovec parts[] = { { &header, sizeof( header ) }, { payload, sizeof( payload ) } };
+
+        ASSERT( in.remove( parts, 2 ) == sizeof( header ) + i );
+        ASSERT( header == i );
+        ASSERT( i == 0 || ( payload[0] == 'a' + ( char )( i % 26 ) && payload[i - 1] == payload[0] ) );
+    }
+
+    char bytes[12];
+    struct iovec parts[12];
+    for( int i = 0; i < 12; i++ ) {
+        parts[i] = { &bytes[11 - i], 1 };
+    }
+    ASSERT( in.remove( parts, 12 ) == 12 );
+    ASSERT( bytes[11] == 'a' && bytes[1] == 'k' && bytes[0] == '\0' );
+
+    char small[1];
+    ASSERT( in.remove( small, sizeof( small ) ) == 0 );
+
+    bool eof = false;
+    try {
+        in.remove( small, sizeof( small ) );
+    } catch( const IPC::QueueEOF& e ) {
+        eof = true;
+    }
+    ASSERT( eof );
+
+    /* after a bad length the queue can't find the next record */
+    const string bad_name = "/tmp/cv_test_framed_bad";
+    Resource<IPC::FramedQueue<64>, string> bad_res{ bad_name };
+    IPC::Process bad_writer{ [&bad_name](){
+        int fd = open( bad_name.c_str(), O_WRONLY );
+        uint32_t records[] = { 1000, 0 };
+        write( fd, records, sizeof( records ) );
+        close( fd );
+    } };
+
+    IPC::FramedQueue<64> bad{ bad_name, IPC::QueueMode::read };
+    size_t errors = 0;
+    for( int i = 0; i < 2; i++ ) {
+        try {
+            bad.remove( small, sizeof( small ) );
+        } catch( const IPC::QueueError& e ) {
+            errors++;
+        }
+    }
+    ASSERT( errors == 2 );
+}
+
+
+static void _test_mapped_mem( const char *filename ) {
+    IPC::Key key{ filename, 'm' };
+    Resource<IPC::MappedMem<size_t>> mem_res{ key, 1000 };
+
+    IPC::Process{ [key](){
+        IPC::MappedMem<size_t> mem{ key, 1000, IPC::MapOptions::prefault };
+        for( size_t i = 0; i < mem.size(); i++ ) {
+            mem[i] = i * 2;
+        }
+    } };
+
+    /* attaches to the whole segment, possibly at another address */
+    IPC::MappedMem<size_t> mem{ key, 1000, IPC::MapOptions::prefault | IPC::MapOptions::huge_pages };
+    IPC::MappedMem<size_t> whole{ key };
+    ASSERT( whole.size() == 1000 );
+    ASSERT( mem[999] == 1998 && *whole.get_ptr( 500 ) == 1000 );
+
+    whole.set_zero();
+    ASSERT( mem[999] == 0 );
+}
+
+
+static void _test_players_segments( const char *filename ) {
+    /* each player takes 1MB, so a segment holds 2 players */
+    IPC::Key key{ filename, 't' };
+    Resource<PlayersTable> players_res{ key, 131060 };
+    PlayersTable players{ key };
+    PlayersTable other{ key };
+
+    players.add_player();
+    ASSERT( other.size() == 1 );
+    ASSERT( other.get_player_ro( 1 ).num_matches() == 0 );
+
+    /* the other instance maps the new segments when they are accessed */
+    for( size_t i = 0; i < 4; i++ ) {
+        players.add_player();
+    }
+    IPC::Process{ [key](){
+        PlayersTable table{ key };
+        Player p1 = table.get_player( 1 );
+        Player p5 = table.get_player( 5 );
+        p1.set_pair( p5 );
+    } };
+
+    ASSERT( other.size() == 5 );
+    ASSERT( other.get_player_ro( 5 ).get_state() == PlayerState::idle );
+    ASSERT( other.get_player_ro( 5 ).has_played_with( players.get_player( 1 ) ) );
+    ASSERT( other.get_player_ro( 4 ).num_matches() == 0 );
+}
+
+
+static void _test_players_index( const char *filename ) {
+    IPC::Key key{ filename, 'i' };
+    Resource<PlayersTable> players_res{ key, 1 };
+    PlayersTable players{ key };
+
+    /* the players take two words of the bitmap */
+    for( size_t i = 0; i < 70; i++ ) {
+        players.add_player();
+    }
+    std::vector<player_t> ids;
+    players.available_players( ids );
+    ASSERT( players.available() == 70 && ids.size() == 70 );
+    ASSERT( ids[0] == 1 && ids[64] == 65 && ids[69] == 70 );
+
+    /* claimed players leave the index */
+    ASSERT( players.claim( { 1, 2, 65, 66 } ) );
+    ASSERT( players.claim( { 67, 68, 69, 70 } ) );
+    players.available_players( ids );
+    ASSERT( players.available() == 62 && ids.size() == 62 );
+    ASSERT( ids.front() == 3 && ids.back() == 64 );
+
+    /* a window of the index goes on from the first player */
+    players.available_players( ids, 60, 8 );
+    ASSERT( ids.size() == 8 && ids[0] == 60 && ids[4] == 64 && ids[5] == 3 && ids.back() == 5 );
+    players.available_players( ids, 65, 4 );
+    ASSERT( ids.size() == 4 && ids.front() == 3 && ids.back() == 6 );
+
+    /* players with no matches left don't go back to the index */
+    {
+        Player p1 = players.get_player( 1 );
+        Player p2 = players.get_player( 2 );
+        p1.set_pair( p2 );
+        p1.set_state( PlayerState::idle );
+        p2.set_state( PlayerState::idle );
+    }
+    ASSERT( players.available() == 62 && players.exhausted() == 2 );
+
+    /* the index is shared */
+    uint32_t changes = players.changes();
+    IPC::Process{ [key](){
+        PlayersTable table{ key };
+        table.get_player( 69 ).set_state( PlayerState::idle );
+    } };
+    players.wait_changes( changes, std::chrono::milliseconds( 0 ) );
+    ASSERT( players.changes() != changes );
+    players.available_players( ids );
+    ASSERT( players.available() == 63 && ids.size() == 63 && ids.back() == 69 );
+}
+
+
+static void _test_matchmaker( const char *filename ) {
+    IPC::Key key{ filename, 'k' };
+    Resource<PlayersTable> players_res{ key, 3 };
+    PlayersTable players{ key };
+    for( size_t i = 0; i < 9; i++ ) {
+        players.add_player();
+    }
+
+    /* a single pass forms as many matches as possible, with different players */
+    Matchmaker matchmaker{ players };
+    std::vector<Match> batch;
+    ASSERT( matchmaker.find_matches( batch, 10 ) == 2 );
+    std::set<player_t> taken;
+    for( const Match& m: batch ) {
+        for( player_t id: { m.team1.player1, m.team1.player2, m.team2.player1, m.team2.player2 } ) {
+            ASSERT( players.get_player_ro( id ).get_state() == PlayerState::playing );
+            taken.insert( id );
+        }
+    }
+    ASSERT( taken.size() == 8 && players.available() == 1 );
+    std::vector<Match> played = batch;
+    ASSERT( matchmaker.find_matches( batch, 10 ) == 0 );
+
+    /* the players are given back with their pairs set, and teams are not repeated */
+    for( const Match& m: played ) {
+        for( const Team& t: { m.team1, m.team2 } ) {
+            Player p1 = players.get_player( t.player1 );
+            Player p2 = players.get_player( t.player2 );
+            p1.set_pair( p2 );
+            p1.set_state( PlayerState::idle );
+            p2.set_state( PlayerState::idle );
+        }
+    }
+    ASSERT( matchmaker.find_matches( batch, 1 ) == 1 );
+    for( const Team& t: { batch[0].team1, batch[0].team2 } ) {
+        ASSERT( !players.get_player_ro( t.player1 ).has_played_with( players.get_player( t.player2 ) ) );
+    }
+
+    /* players with matches left that already played with everyone can't form a match */
+    IPC::Key other_key{ filename, 'j' };
+    Resource<PlayersTable> other_res{ other_key, 5 };
+    PlayersTable other{ other_key };
+    for( size_t i = 0; i < 4; i++ ) {
+        other.add_player();
+    }
+    for( player_t id = 1; id <= 4; id++ ) {
+        for( player_t partner = id + 1; partner <= 4; partner++ ) {
+            Player p1 = other.get_player( id );
+            Player p2 = other.get_player( partner );
+            p1.set_pair( p2 );
+        }
+    }
+    Matchmaker other_matchmaker{ other };
+    ASSERT( other.available() == 4 && !other_matchmaker.can_form_match() );
+
+    /* all the possible teams have the new player */
+    other.add_player();
+    ASSERT( !other_matchmaker.can_form_match() );
+    other.add_player();
+    ASSERT( other_matchmaker.can_form_match() && other.available() == 6 );
+
+    /* the candidates are taken in windows from the index, one after the other */
+    IPC::Key many_key{ filename, 'y' };
+    Resource<PlayersTable> many_res{ many_key, 3 };
+    PlayersTable many{ many_key };
+    for( size_t i = 0; i < 200; i++ ) {
+        many.add_player();
+    }
+    Matchmaker many_matchmaker{ many };
+    for( player_t last: { 2 * Matchmaker::CANDIDATES_PER_MATCH, 4 * Matchmaker::CANDIDATES_PER_MATCH } ) {
+        ASSERT( many_matchmaker.find_matches( batch, 2 ) == 2 );
+        for( const Match& m: batch ) {
+            for( player_t id: { m.team1.player1, m.team1.player2, m.team2.player1, m.team2.player2 } ) {
+                ASSERT( id > last - 2 * Matchmaker::CANDIDATES_PER_MATCH && id <= last );
+            }
+        }
+    }
+    ASSERT( many.available() == 184 );
+}
+
+
+static void _test_players_snapshot( const char *filename ) {
+    IPC::Key key{ filename, 'v' };
+    Resource<PlayersTable> players_res{ key, 300 };
+    PlayersTable players{ key };
+    for( size_t i = 0; i < 201; i++ ) {
+        players.add_player();
+    }
+
+    /* the snapshots don't wait for the lock of the player */
+    PlayerSnapshot snap;
+    {
+        Player p1 = players.get_player( 1 );
+        Player p2 = players.get_player( 2 );
+        p1.set_pair( p2 );
+        p2.set_state( PlayerState::playing );
+        players.snapshot( 2, snap );
+    }
+    ASSERT( snap.id == 2 && snap.state == PlayerState::playing );
+    ASSERT( snap.num_matches() == 1 && snap.has_played_with( 1 ) && !snap.has_played_with( 3 ) );
+
+    /* the copies are consistent while another process changes the player */
+    IPC::Process writer{ [key](){
+        PlayersTable table{ key };
+        Player p1 = table.get_player( 1 );
+        for( player_t id = 3; id <= 201; id++ ) {
+            Player other = table.get_player( id );
+            p1.set_pair( other );
+        }
+    } };
+    for( size_t i = 0; i < 1000; i++ ) {
+        players.snapshot( 1, snap );
+        for( size_t j = 0; j < snap.pairs.size(); j++ ) {
+            ASSERT( snap.pairs[j] == j + 2 );
+        }
+    }
+    writer = IPC::Process{};
+
+    std::vector<PlayerSnapshot> all;
+    players.snapshot( all );
+    ASSERT( all.size() == 201 && all[0].num_matches() == 200 && all[200].has_played_with( 1 ) );
+}
+
+
+static void _test_pair_search() {
+    /* every length and position, so the vector loops and the remainders are covered */
+    size_t pairs[40];
+    for( size_t i = 0; i < 40; i++ ) {
+        pairs[i] = 1000 + i;
+    }
+    for( size_t n = 0; n <= 40; n++ ) {
+        for( size_t i = 0; i < 40; i++ ) {
+            ASSERT_MSG( PairSearch::contains( pairs, n, 1000 + i ) == ( i < n ), PairSearch::kernel() );
+        }
+        ASSERT( !PairSearch::contains( pairs, n, 0 ) );
+    }
+
+    const size_t* histories[] = { pairs, pairs + 10, pairs + 20, pairs };
+    size_t sizes[] = { 10, 10, 20, 0 };
+    bool found[4];
+    ASSERT( PairSearch::contains_many( 1015, histories, sizes, 4, found ) == 1 );
+    ASSERT( !found[0] && found[1] && !found[2] && !found[3] );
+    ASSERT( PairSearch::contains_many( 1005, histories, sizes, 4, found ) == 1 && found[0] );
+}
+
+
+static void _test_log_rings() {
+    const string name = "/cv_test_log";
+    Resource<IPC::LogRings, string> rings_res{ name };
+    IPC::LogRings rings{ name };
+
+    /* a long message takes many records but is taken as a whole */
+    string longer( IPC::LogRings::TEXT_SIZE * 2 + 10, 'x' );
+    ASSERT( rings.write( 10, "first\n" ) );
+    ASSERT( rings.write( 30, longer ) );
+
+    /* each process writes its own ring */
+    IPC::Process{ [name](){
+        IPC::LogRings child{ name };
+        ASSERT( child.write( 20, "child\n" ) );
+    } };
+
+    std::vector<IPC::LogRings::Message> messages;
+    rings.drain( messages );
+    ASSERT( messages.size() == 3 );
+    ASSERT( messages[0].text == "first\n" && messages[0].pid == getpid() );
+    ASSERT( messages[1].text == longer && messages[1].timestamp == 30 );
+    ASSERT( messages[2].text == "child\n" && messages[2].pid != getpid() );
+
+    /* the ring of the child is freed, only this process is left */
+    ASSERT( rings.writers( 0, 0 ) == 1 );
+    messages.clear();
+    rings.drain( messages );
+    ASSERT( messages.empty() );
+}
+
+
+static void _test_bin_log() {
+    const string filename = "/tmp/cv_test_log.bin";
+    BinLog::get_instance().open( filename, true );
+
+    LOG_BIN( "no arguments" );
+    for( int i = 0; i < 3; i++ ) {
+        LOG_BIN( "event {} of {} ({})", i, static_cast<size_t>( 3 ), string( "text" ) );
+    }
+
+    /* the children append their own events */
+    IPC::Process{ [](){
+        LOG_BIN( "child {} {}", -1, 0.5 );
+    } };
+    BinLog::get_instance().close();
+
+    BinLogReader log{ filename };
+    ASSERT( log.sites.size() == 3 && log.events.size() == 5 );
+    ASSERT( log.format( log.events[0] ) == "no arguments" );
+    ASSERT( log.format( log.events[3] ) == "event 2 of 3 (text)" );
+    ASSERT( log.events[3].args[1].type == 'u' && log.events[3].args[2].type == 's' );
+    ASSERT( log.format( log.events[4] ) == "child -1 0.5" && log.events[4].pid != getpid() );
+    ASSERT( log.site( log.events[4] )->file == __FILE__ );
+
+    /* a string longer than its record is not read */
+    std::ifstream in{ filename, std::ios::binary };
+    string data{ std::istreambuf_iterator<char>( in ), std::istreambuf_iterator<char>() };
+    in.close();
+    size_t pos = data.find( string( "\x04\x00text", 6 ) );
+    ASSERT( pos != string::npos );
+    data[pos + 1] = '\x7f';
+    std::ofstream{ filename, std::ios::binary | std::ios::trunc } << data;
+
+    bool corrupt = false;
+    try {
+        BinLogReader{ filename };
+    } catch( const BinLog::Error& e ) {
+        corrupt = true;
+    }
+    ASSERT( corrupt );
+    unlink( filename.c_str() );
+
+    /* a failed write drops the records without failing the caller */
+    BinLog::get_instance().open( "/dev/full", false );
+    for( size_t i = 0; i < 10000; i++ ) {
+        LOG_BIN( "dropped {}", i );
+    }
+    ASSERT( BinLog::get_instance().lost() > 0 );
+    BinLog::get_instance().close();
+    ASSERT( BinLog::get_instance().lost() > 10000 );
+}
+
+
+struct _Node {
+    size_t value;
+    IPC::OffsetPtr<_Node> next;
+};
+
+struct _List {
+    IPC::OffsetPtr<IPC::Pool<_Node>> pool;
+    IPC::OffsetPtr<_Node> first;
+};
+
+static void _test_arena( const char *filename ) {
+    IPC::Key key{ filename, 'z' };
+    Resource<IPC::Arena> arena_res{ key, 64 * 1024 };
+
+    /* builds a list in another process */
+    IPC::Process{ [key](){
+        IPC::Arena arena{ key };
+        _List* list = arena.create<_List>();
+        list->pool = arena.create<IPC::Pool<_Node>>( arena, 100 );
+        arena.set_root( list );
+
+        for( size_t i = 0; i < 100; i++ ) {
+            _Node* node = list->pool->create();
+            node->value = i;
+            node->next = list->first;
+            list->first = node;
+        }
+        ASSERT( list->pool->allocate() == nullptr );
+
+        /* releases the even nodes */
+        for( _Node* node = list->first.get(); node != nullptr; node = node->next.get() ) {
+            while( node->next && node->next->value % 2 == 0 ) {
+                _Node* even = node->next.get();
+                node->next = even->next;
+                list->pool->destroy( even );
+            }
+        }
+    } };
+
+    /* two mappings at different addresses see the same list */
+    IPC::Arena arena{ key };
+    IPC::Arena other{ key };
+    _List* list = arena.root<_List>();
+    ASSERT( list != nullptr && other.root<_List>() != list );
+    ASSERT( list->pool->available() == 50 && other.root<_List>()->pool->available() == 50 );
+
+    size_t expected = 99;
+    for( _Node* node = other.root<_List>()->first.get(); node != nullptr; node = node->next.get() ) {
+        ASSERT( node->value == expected );
+        expected -= 2;
+    }
+
+    /* the released nodes are reused */
+    for( size_t i = 0; i < 50; i++ ) {
+        ASSERT( list->pool->create() != nullptr );
+    }
+    ASSERT( list->pool->allocate() == nullptr );
+
+    bool exhausted = false;
+    try {
+        arena.allocate( 64 * 1024 );
+    } catch( const IPC::Arena::Error& e ) {
+        exhausted = true;
+    }
+    ASSERT( exhausted );
+}
+
+
+static void _test_rw_lock( const char *filename ) {
+    IPC::Key key{ filename, 'l' };
+    Resource<IPC::SharedMem<std::atomic<uint32_t>>> mem_res{ key, 2 };
+    IPC::SharedMem<std::atomic<uint32_t>> mem{ key, 2 };
+    std::atomic<uint32_t>* word = mem.get_ptr( 0 );
+    std::atomic<uint32_t>* reads = mem.get_ptr( 1 );
+    word->store( 0 );
+    reads->store( 0 );
+
+    /* the process can take the lock again in any mode */
+    {
+        IPC::RWLock r1{ word, IPC::RWLock::Mode::read };
+        IPC::RWLock r2{ word, IPC::RWLock::Mode::read };
+        IPC::RWLock w{ word, IPC::RWLock::Mode::write };
+    }
+    ASSERT( word->load() == 0 );
+
+    IPC::Process reader;
+    {
+        IPC::RWLock w{ word, IPC::RWLock::Mode::write };
+
+        /* the child does not inherit the lock, so it waits for the parent to release it */
+        reader = IPC::Process{ [word, reads](){
+            IPC::RWLock r{ word, IPC::RWLock::Mode::read };
+            reads->fetch_add( 1 );
+        } };
+        usleep( 100000 );
+        ASSERT( reads->load() == 0 );
+    }
+
+    while( reads->load() == 0 ) {
+        usleep( 1000 );
+    }
+    {
+        IPC::RWLock w{ word, IPC::RWLock::Mode::write };
+    }
+
+    /* two processes upgrading at once: the second one fails instead of waiting forever */
+    IPC::Process upgrader;
+    {
+        IPC::RWLock r{ word, IPC::RWLock::Mode::read };
+        upgrader = IPC::Process{ [word, reads](){
+            IPC::RWLock r{ word, IPC::RWLock::Mode::read };
+            reads->fetch_add( 1 );
+            IPC::RWLock w{ word, IPC::RWLock::Mode::write };
+        } };
+        while( reads->load() < 2 ) {
+            usleep( 1000 );
+        }
+        usleep( 100000 );
+
+        bool deadlock = false;
+        try {
+            IPC::RWLock w{ word, IPC::RWLock::Mode::write };
+        } catch( const IPC::RWLock::Error& e ) {
+            deadlock = true;
+        }
+        ASSERT( deadlock );
+    }
+
+    /* the upgrade goes on once the parent leaves */
+    upgrader = IPC::Process{};
+    ASSERT( word->load() == 0 );
+}
+
+
+static void _test_barrier( const char *filename ) {
+    IPC::Key key{ filename, 'b' };
+    Resource<IPC::Barrier> barrier_res{ key, 1 };
+    IPC::Barrier barrier{ key };
+    ASSERT( barrier.value() == 1 );
+
+    /* the child waits until the parent signals */
+    IPC::Process waiter{ [key](){
+        IPC::Barrier tide{ key };
+        tide.wait();
+    } };
+    usleep( 100000 );
+    ASSERT( barrier.value() == 1 );
+    barrier.signal();
+    ASSERT( barrier.value() == 0 );
+    waiter = IPC::Process{};
+
+    /* an open barrier does not block */
+    barrier.wait();
+
+    /* signal blocks while the value is 0, until another process sets it */
+    IPC::Process setter{ [key](){
+        usleep( 100000 );
+        IPC::Barrier tide{ key };
+        tide.set( 2 );
+    } };
+    barrier.signal();
+    ASSERT( barrier.value() == 1 );
+    setter = IPC::Process{};
+
+    IPC::Barrier copy{ barrier };
+    copy.reset();
+    ASSERT( barrier.value() == 0 );
+}
+
+
+static void _test_barrier_set( const char *filename ) {
+    IPC::Key key{ filename, 'c' };
+    size_t rows = 4096;
+    Resource<IPC::BarrierSet> tides_res{ key, rows };
+    IPC::BarrierSet tides{ key };
+    ASSERT( tides.size() == rows );
+    ASSERT( tides.value( 0 ) == 0 && tides.value( rows - 1 ) == 0 );
+
+    /* open barriers do not block */
+    tides.wait( 0 );
+    tides.wait( rows - 1 );
+
+    /* several rows are closed at once */
+    tides.set( { { 1, 1 }, { rows - 1, 1 } } );
+    ASSERT( tides.value( 1 ) == 1 && tides.value( 2 ) == 0 && tides.value( rows - 1 ) == 1 );
+
+    /* the child waits for the last row while the others change */
+    IPC::Process waiter{ [key, rows](){
+        IPC::BarrierSet t{ key };
+        t.wait( rows - 1 );
+    } };
+    usleep( 100000 );
+    tides.signal( 1 );
+    usleep( 100000 );
+    ASSERT( tides.value( rows - 1 ) == 1 );
+    tides.signal( rows - 1 );
+    waiter = IPC::Process{};
+
+    bool thrown = false;
+    try {
+        tides.set( { { 0, 1 }, { rows, 1 } } );
+    } catch( const IPC::BarrierSet::Error& e ) {
+        thrown = true;
+    }
+    ASSERT( thrown && tides.value( 0 ) == 0 );
+}
+
+
 int main( int argc, const char *argv[] ) {
     int rv = 0;
     bool child = false;
@@ -67,7 +962,6 @@ int main( int argc, const char *argv[] ) {
     Log::get_instance().set_level( Log::Level::debug );
 
     try {
-        size_t max_players = 15;
         size_t max_matches = 8;
 
         /* signal handlers */
@@ -75,8 +969,8 @@ int main( int argc, const char *argv[] ) {
         SignalHandler::get_instance()->add_handler( SIGINT, &eh );
         SignalHandler::get_instance()->add_handler( SIGPIPE, &eh );
 
-        Resource<PlayersTable> players_res{ argv[0], max_players, max_matches };
-        PlayersTable players{ argv[0], max_players, max_matches };
+        Resource<PlayersTable> players_res{ argv[0], max_matches };
+        PlayersTable players{ argv[0] };
 
         ASSERT( players.size() == 0 );
         
@@ -157,6 +1051,37 @@ int main( int argc, const char *argv[] ) {
             id++;
         }
 
+        /* claims are all or nothing */
+        ASSERT( players.claim( { 11, 12 } ) );
+        ASSERT( players.get_player_ro( 12 ).get_state() == PlayerState::playing );
+        ASSERT( players.claim( { 13, 14, 12 } ) == false );
+        ASSERT( players.get_player_ro( 13 ).get_state() == PlayerState::idle );
+        ASSERT( players.get_player_ro( 14 ).get_state() == PlayerState::idle );
+        ASSERT( players.claim( { 13, 13 } ) == false );
+        ASSERT( players.claim( { 13, 14 } ) );
+
+        _test_ring_queue();
+        _test_ring_queue_timeouts();
+        _test_queue_batches();
+        _test_queue_timeouts();
+        _test_selector();
+        _test_semaphore( argv[0] );
+        _test_mqueue();
+        _test_journal();
+        _test_framed_queue();
+        _test_mapped_mem( argv[0] );
+        _test_players_segments( argv[0] );
+        _test_players_index( argv[0] );
+        _test_matchmaker( argv[0] );
+        _test_players_snapshot( argv[0] );
+        _test_pair_search();
+        _test_log_rings();
+        _test_bin_log();
+        _test_arena( argv[0] );
+        _test_rw_lock( argv[0] );
+        _test_barrier( argv[0] );
+        _test_barrier_set( argv[0] );
+
     } catch( const AssertError& e ) {
         cout << "Assertion error at " << e.what() << endl;
         rv = 1;